@@ -0,0 +1,59 @@
+#!/bin/bash
+# Generates large Kaleidoscope sources on stdout for the benchmarks.
+#   gen.sh funcs N     N functions with loops, conditionals, local arrays and calls
+#   gen.sh args N      a function with N parameters, and a call passing N arguments
+#   gen.sh vecinit N   a local array with an initializer list of N elements
+#   gen.sh stmts N     a function body made of N statements
+
+mode=$1
+n=${2:-1000}
+
+case $mode in
+funcs)
+  awk -v n="$n" 'BEGIN {
+    print "extern printval(x y);";
+    print "global G[16];";
+    for (f = 0; f < n; f++) {
+      printf "def f%d(x y) {\n", f;
+      print "  var a = x*2+y;";
+      print "  var B[4] = {x, y, a, 1};";
+      print "  for (var i = 0; i < 16; ++i) {";
+      print "    a = a + B[i-i] * (x - y) / 3;";
+      print "    G[i] = G[i] + a;";
+      print "    if (a > 100) a = a - 100 else a = a + 1";
+      print "  };";
+      if (f > 0) printf "  a < 0 ? -a : a + f%d(a, y)\n", f - 1;
+      else print "  a < 0 ? -a : a";
+      print "};";
+    }
+  }'
+  ;;
+args)
+  awk -v n="$n" 'BEGIN {
+    printf "def f(";
+    for (i = 0; i < n; i++) printf "a%d%s", i, (i % 16 == 15 ? "\n" : " ");
+    printf ") { a0 + a%d };\n", n - 1;
+    printf "def g() { f(";
+    for (i = 0; i < n; i++) printf "%d%s", i, (i == n - 1 ? "" : (i % 16 == 15 ? ",\n" : ", "));
+    print ") };";
+  }'
+  ;;
+vecinit)
+  awk -v n="$n" 'BEGIN {
+    printf "def f() { var A[%d] = {", n;
+    for (i = 0; i < n; i++) printf "%d%s", i, (i == n - 1 ? "" : (i % 16 == 15 ? ",\n" : ", "));
+    printf "}; A[%d] };\n", n - 1;
+  }'
+  ;;
+stmts)
+  awk -v n="$n" 'BEGIN {
+    print "def f(x) { var a = x;";
+    for (i = 0; i < n; i++) printf "  a = a * 2 + %d;\n", i;
+    print "  a };";
+  }'
+  ;;
+*)
+  echo "usage: $0 funcs|args|vecinit|stmts N" >&2
+  exit 1
+  ;;
+esac
@@ -0,0 +1,72 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "llvm/Support/Allocator.h"
+
+// Bump-pointer arena AST nodes are allocated from.
+// Nodes are laid out contiguously in allocation order, and are all destroyed
+// and released in one go by reset() or when the arena itself goes away.
+class ASTArena {
+private:
+  llvm::BumpPtrAllocator allocator;
+  std::vector<llvm::BumpPtrAllocator> absorbed;  // Of other arenas, see absorb()
+  // Nodes owning heap memory (strings, vectors) must still be destructed
+  std::vector<std::pair<void*, void (*)(void*)>> destructors;
+  size_t nodes = 0;
+  size_t peak = 0;  // Largest footprint before a reset
+
+public:
+  ASTArena() = default;
+  ASTArena(const ASTArena&) = delete;
+  ASTArena& operator=(const ASTArena&) = delete;
+  ~ASTArena() { reset(); }
+
+  template <typename T, typename... Args>
+  T *make(Args&&... args) {
+    T *node = new (allocator.Allocate<T>()) T(std::forward<Args>(args)...);
+    nodes++;
+    if constexpr (not std::is_trivially_destructible_v<T>)
+      destructors.emplace_back(node, [](void *p) { static_cast<T*>(p)->~T(); });
+    return node;
+  }
+
+  // Takes over the nodes of other, which is left empty: they are now released
+  // with those of this arena. Merges ASTs built by different drivers.
+  void absorb(ASTArena &other) {
+    absorbed.push_back(std::move(other.allocator));
+    for (auto &a : other.absorbed)
+      absorbed.push_back(std::move(a));
+    destructors.insert(destructors.end(), other.destructors.begin(), other.destructors.end());
+    nodes += other.nodes;
+    other.absorbed.clear();
+    other.destructors.clear();
+    other.nodes = 0;
+  }
+
+  void reset() {
+    peak = std::max(peak, getBytesAllocated());
+    // Reverse order, as for automatic objects
+    for (auto it = destructors.rbegin(); it != destructors.rend(); ++it)
+      it->second(it->first);
+    destructors.clear();
+    absorbed.clear();
+    allocator.Reset();
+    nodes = 0;
+  }
+
+  size_t getNodeCount() const { return nodes; }
+  size_t getBytesAllocated() const {
+    size_t bytes = allocator.getBytesAllocated();
+    for (auto &a : absorbed)
+      bytes += a.getBytesAllocated();
+    return bytes;
+  }
+  size_t getPeakBytes() const { return std::max(peak, getBytesAllocated()); }
+};
+
+#endif // ! ARENA_HPP
@@ -0,0 +1,158 @@
+#include "backend.hpp"
+
+#include <mutex>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Analysis/CGSCCPassManager.h"
+#include "llvm/Analysis/LoopAnalysisManager.h"
+#include "llvm/CodeGen/ParallelCG.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+
+static CodeGenOpt::Level toCodeGenLevel(unsigned optLevel) {
+  switch (optLevel) {
+  case 0: return CodeGenOpt::None;
+  case 1: return CodeGenOpt::Less;
+  case 2: return CodeGenOpt::Default;
+  default: return CodeGenOpt::Aggressive;
+  }
+}
+
+static OptimizationLevel toOptimizationLevel(unsigned optLevel) {
+  switch (optLevel) {
+  case 0: return OptimizationLevel::O0;
+  case 1: return OptimizationLevel::O1;
+  case 2: return OptimizationLevel::O2;
+  default: return OptimizationLevel::O3;
+  }
+}
+
+std::unique_ptr<TargetMachine> createHostTargetMachine(unsigned optLevel, raw_ostream &diag) {
+  // Target registration is not thread-safe: it is done once per process
+  static std::once_flag targetsInitialized;
+  std::call_once(targetsInitialized, [] {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+    InitializeNativeTargetAsmParser();
+  });
+
+  std::string triple = sys::getDefaultTargetTriple();
+  std::string error;
+  const Target *target = TargetRegistry::lookupTarget(triple, error);
+  if (not target) {
+    diag << "Cannot find target for " << triple << ": " << error << "\n";
+    return nullptr;
+  }
+
+  // Kernels are run where they are built: tune for the host CPU
+  SubtargetFeatures features;
+  StringMap<bool> hostFeatures;
+  if (sys::getHostCPUFeatures(hostFeatures))
+    for (auto &feature : hostFeatures)
+      features.AddFeature(feature.first(), feature.second);
+
+  std::unique_ptr<TargetMachine> tm(target->createTargetMachine(
+    triple,
+    sys::getHostCPUName(),
+    features.getString(),
+    TargetOptions(),
+    Reloc::PIC_,
+    {},  // Default code model
+    toCodeGenLevel(optLevel)
+  ));
+  if (not tm)
+    diag << "Cannot create a target machine for " << triple << "\n";
+  return tm;
+}
+
+bool optimizeModule(Module &module, TargetMachine &tm, unsigned optLevel, raw_ostream &diag) {
+  if (verifyModule(module, &diag)) return false;
+  if (optLevel == 0) return true;
+
+  // Vectorizers are off by default in the tuning options: enable them as clang does
+  PipelineTuningOptions tuning;
+  tuning.LoopVectorization = optLevel > 1;
+  tuning.SLPVectorization = optLevel > 1;
+
+  LoopAnalysisManager lam;
+  FunctionAnalysisManager fam;
+  CGSCCAnalysisManager cgam;
+  ModuleAnalysisManager mam;
+
+  PassBuilder pb(&tm, tuning);
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cgam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+  ModulePassManager mpm = pb.buildPerModuleDefaultPipeline(toOptimizationLevel(optLevel));
+  mpm.run(module, mam);
+  return true;
+}
+
+FunctionOptimizer::FunctionOptimizer(TargetMachine &tm, unsigned optLevel, raw_ostream &diag) :
+  pb(&tm), optLevel(optLevel), diag(diag) {
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cgam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cgam, mam);
+  if (optLevel > 0)
+    fpm = pb.buildFunctionSimplificationPipeline(toOptimizationLevel(optLevel), ThinOrFullLTOPhase::None);
+}
+
+bool FunctionOptimizer::run(Function &function) {
+  if (verifyFunction(function, &diag)) return false;
+  if (optLevel == 0) return true;
+
+  fpm.run(function, fam);
+  // Streamed functions lose their body once written: nothing is cached about them
+  fam.clear(function, function.getName());
+  return true;
+}
+
+bool emitModule(Module &module, TargetMachine &tm, raw_pwrite_stream &out, CodeGenFileType fileType,
+                raw_ostream &diag) {
+  // Code generation still runs on the legacy pass manager
+  legacy::PassManager pm;
+  if (tm.addPassesToEmitFile(pm, out, nullptr, fileType)) {
+    diag << "The target cannot emit a file of this type\n";
+    return false;
+  }
+
+  pm.run(module);
+  out.flush();
+  return true;
+}
+
+bool emitModuleSplit(Module &module, unsigned optLevel, ArrayRef<raw_pwrite_stream*> outs, CodeGenFileType fileType,
+                     raw_ostream &diag) {
+  // splitCodeGen aborts when the target cannot emit the file: check first
+  auto tm = createHostTargetMachine(optLevel, diag);
+  if (not tm) return false;
+  legacy::PassManager pm;
+  raw_null_ostream null;
+  if (tm->addPassesToEmitFile(pm, null, nullptr, fileType)) {
+    diag << "The target cannot emit a file of this type\n";
+    return false;
+  }
+
+  // Each partition goes through bitcode into a context of its own, as contexts
+  // cannot be shared between threads. The target was found above: the
+  // partitions' own lookups cannot fail, and write nothing to diag.
+  splitCodeGen(module, outs, {}, [optLevel] {
+    raw_null_ostream none;
+    return createHostTargetMachine(optLevel, none);
+  }, fileType);
+  for (auto *out : outs)
+    out->flush();
+  return true;
+}
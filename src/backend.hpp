@@ -0,0 +1,60 @@
+#ifndef BACKEND_HPP
+#define BACKEND_HPP
+
+#include <memory>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+using namespace llvm;
+
+// Errors are written to the diag stream each function takes: the process's
+// stderr, or a buffer sent back to a client of the server.
+
+// Builds a TargetMachine for the host triple and CPU.
+// It drives target-aware cost models in the optimizer (e.g. vector widths).
+// A TargetMachine must not be shared between threads: create one per thread.
+// Returns null, after saying why on diag, if none can be built.
+std::unique_ptr<TargetMachine> createHostTargetMachine(unsigned optLevel, raw_ostream &diag);
+
+// Runs the new-PassManager default -O<optLevel> pipeline on the whole module.
+// Returns false if the module is malformed and has not been optimized.
+bool optimizeModule(Module &module, TargetMachine &tm, unsigned optLevel, raw_ostream &diag);
+
+// Optimizes functions one at a time, for output that is streamed function by
+// function: only the intra-procedural -O<optLevel> simplification passes run,
+// with no inlining. Analyses are kept across functions of the same module.
+class FunctionOptimizer {
+private:
+  LoopAnalysisManager lam;
+  FunctionAnalysisManager fam;
+  CGSCCAnalysisManager cgam;
+  ModuleAnalysisManager mam;
+  PassBuilder pb;
+  FunctionPassManager fpm;
+  unsigned optLevel;
+  raw_ostream &diag;
+
+public:
+  FunctionOptimizer(TargetMachine &tm, unsigned optLevel, raw_ostream &diag);
+  bool run(Function &function);  // False if the function is malformed
+};
+
+// Lowers the module to a native object or assembly file in-process.
+// fileType is either CGFT_ObjectFile or CGFT_AssemblyFile.
+bool emitModule(Module &module, TargetMachine &tm, raw_pwrite_stream &out, CodeGenFileType fileType,
+                raw_ostream &diag);
+
+// Splits the module into outs.size() partitions and lowers each to outs[i] on a
+// thread of its own, with a TargetMachine of its own. Linked together, the
+// outputs are equivalent to the one emitModule would write. The module is left
+// unusable: it must be the last thing done with it.
+bool emitModuleSplit(Module &module, unsigned optLevel, ArrayRef<raw_pwrite_stream*> outs, CodeGenFileType fileType,
+                     raw_ostream &diag);
+
+#endif // ! BACKEND_HPP
@@ -0,0 +1,73 @@
+#include "cache.hpp"
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+bool DefinitionCache::open(std::string &error) {
+  if (std::error_code ec = sys::fs::create_directories(dir)) {
+    error = "cannot create " + dir + ": " + ec.message();
+    return false;
+  }
+  return true;
+}
+
+std::string DefinitionCache::keyOf(const Module &module) const {
+  std::string text = "kcomp " LLVM_VERSION_STRING "\n" + flags + "\n";
+  raw_string_ostream out(text);
+  module.print(out, nullptr);
+  out.flush();
+  return toHex(SHA1::hash(arrayRefFromStringRef(text)), true);
+}
+
+std::string DefinitionCache::pathOf(const std::string &key) const {
+  SmallString<256> path(dir);
+  sys::path::append(path, key + ".bc");
+  return path.str().str();
+}
+
+bool DefinitionCache::load(const std::string &key, LLVMContext &context, SmallVectorImpl<char> &bitcode) {
+  std::string path = pathOf(key);
+  auto buffer = MemoryBuffer::getFile(path, false, false);
+  if (not buffer) {
+    misses++;
+    return false;
+  }
+  // Truncated, corrupted or foreign entries are found here, on the worker,
+  // rather than once every definition is to be linked
+  auto module = parseBitcodeFile((*buffer)->getMemBufferRef(), context);
+  if (not module) {
+    consumeError(module.takeError());
+    sys::fs::remove(path);
+    misses++;
+    return false;
+  }
+  bitcode.assign((*buffer)->getBufferStart(), (*buffer)->getBufferEnd());
+  hits++;
+  return true;
+}
+
+void DefinitionCache::store(const std::string &key, StringRef bitcode) {
+  // Written aside and renamed: readers never see a partial entry
+  SmallString<256> model(dir);
+  sys::path::append(model, key + "-%%%%%%.tmp");
+  int fd;
+  SmallString<256> temp;
+  if (sys::fs::createUniqueFile(model, fd, temp)) return;
+  {
+    raw_fd_ostream out(fd, true);
+    out << bitcode;
+    if (out.has_error()) {
+      out.clear_error();
+      sys::fs::remove(temp);
+      return;
+    }
+  }
+  if (sys::fs::rename(temp, pathOf(key)))
+    sys::fs::remove(temp);
+}
@@ -0,0 +1,38 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <atomic>
+#include <string>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Module.h"
+
+using namespace llvm;
+
+// On-disk cache of the optimized bitcode of single definitions, shared by
+// concurrent compilations. It is content-addressed: the key of a definition is
+// the SHA-1 of the unoptimized IR of a module holding it alone, with the
+// declarations of the functions and globals it uses, and of the flags that
+// shape the optimized code. A definition is optimized again only if it, the
+// signatures it depends on or the flags changed.
+class DefinitionCache {
+public:
+  DefinitionCache(std::string dir, std::string flags) : dir(std::move(dir)), flags(std::move(flags)) {};
+  bool open(std::string &error);  // Creates the directory if needed
+
+  std::string keyOf(const Module &module) const;
+  // False on a miss. Entries that do not parse in context are removed and
+  // count as misses: a damaged cache costs time, never the build
+  bool load(const std::string &key, LLVMContext &context, SmallVectorImpl<char> &bitcode);
+  void store(const std::string &key, StringRef bitcode);  // Failures only cost a later miss
+
+  std::atomic<unsigned> hits{0}, misses{0};
+
+private:
+  std::string dir;
+  std::string flags;
+  std::string pathOf(const std::string &key) const;
+};
+
+#endif // ! CACHE_HPP
@@ -0,0 +1,115 @@
+#include "server.hpp"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Nothing here uses LLVM: kclient is built from this file and kclient.cpp alone
+
+// Protocol. The client sends its working directory and its arguments, each
+// terminated by a NUL, then shuts its side of the connection down. The server
+// answers with frames made of a tag, a 32-bit length in network order and as
+// many bytes: 'o' and 'e' carry stdout and stderr, 's' the exit code in decimal.
+// 's' is the last frame.
+
+bool addressOf(const std::string &path, sockaddr_un &addr) {
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "socket path too long: " << path << std::endl;
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+bool writeAll(int fd, const char *data, size_t size) {
+  while (size) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);  // A client gone must not kill the server
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// False if the peer closed the connection before size bytes
+bool readAll(int fd, char *data, size_t size) {
+  while (size) {
+    ssize_t n = read(fd, data, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool writeFrame(int fd, char tag, const std::string &payload) {
+  char header[5];
+  uint32_t size = htonl(payload.size());
+  header[0] = tag;
+  memcpy(header + 1, &size, sizeof(size));
+  return writeAll(fd, header, sizeof(header)) && writeAll(fd, payload.data(), payload.size());
+}
+
+int runClient(const std::string &path, const std::vector<std::string> &args) {
+  sockaddr_un addr;
+  if (not addressOf(path, addr)) return 1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    std::cerr << "cannot connect to the kcomp server at " << path << ": " << strerror(errno) << std::endl;
+    if (fd >= 0) close(fd);
+    return 1;
+  }
+
+  char cwd[PATH_MAX];
+  if (not getcwd(cwd, sizeof(cwd))) {
+    std::cerr << "getcwd: " << strerror(errno) << std::endl;
+    close(fd);
+    return 1;
+  }
+  std::string request(cwd);
+  request += '\0';
+  for (const auto &arg : args) {
+    request += arg;
+    request += '\0';
+  }
+  if (not writeAll(fd, request.data(), request.size()) || shutdown(fd, SHUT_WR) < 0) {
+    std::cerr << "cannot send the request to the kcomp server: " << strerror(errno) << std::endl;
+    close(fd);
+    return 1;
+  }
+
+  for (;;) {
+    char header[5];
+    uint32_t size;
+    if (not readAll(fd, header, sizeof(header))) break;
+    memcpy(&size, header + 1, sizeof(size));
+    std::string payload(ntohl(size), '\0');
+    if (not readAll(fd, &payload[0], payload.size())) break;
+
+    switch (header[0]) {
+    case 'o':
+      std::cout.write(payload.data(), payload.size()).flush();
+      break;
+    case 'e':
+      std::cerr.write(payload.data(), payload.size()).flush();
+      break;
+    case 's':
+      close(fd);
+      return atoi(payload.c_str());
+    }
+  }
+  close(fd);
+  std::cerr << "connection to the kcomp server lost" << std::endl;
+  return 1;
+}
@@ -1,43 +1,325 @@
+#include <cstring>
+#include <sstream>
+
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
 #include "driver.hpp"
 #include "parser.hpp"
+#include "pratt.hpp"
 #include "utils.hpp"
 
 
-LLVMContext *context = new LLVMContext;
-Module *module = new Module("Kaleidoscope", *context);
-IRBuilder<> *builder = new IRBuilder(*context);
+CompilationUnit::CompilationUnit(const std::string &name) :
+  context(std::make_unique<LLVMContext>()),
+  module(std::make_unique<Module>(name, *context)),
+  builder(std::make_unique<IRBuilder<>>(*context)) {};
 
-driver::driver(): trace_parsing(false), trace_scanning(false) {};
+std::unique_ptr<Module> CompilationUnit::startModule(const std::string &name) {
+  auto previous = std::move(module);
+  module = std::make_unique<Module>(name, *context);
+  module->setTargetTriple(previous->getTargetTriple());
+  module->setDataLayout(previous->getDataLayout());
+  std::fill(globals.begin(), globals.end(), nullptr);
+  std::fill(functions.begin(), functions.end(), nullptr);
+  return previous;
+}
+
+driver::driver(): resolver(*this), trace_parsing(false), trace_scanning(false), use_flex(false), use_pratt(false), fast_math(false), parseJobs(1), scanner(nullptr), errors(0), diag(&std::cout), trace(&std::cerr) {};
 
 int driver::parse (const std::string &f) {
-  file = f;                    // Input file
-  location.initialize(&file);
-  scan_begin();                // Input file opening
-  yy::parser parser(*this);    // Parser instantiation
-  parser.set_debug_level(trace_parsing);
-  int res = parser.parse();    // Parser entry-point call
-  scan_end();                  // Input file close
+  // Large files are mapped rather than read; nothing goes through stdio
+  auto maybeBuffer = MemoryBuffer::getFileOrSTDIN(f.empty() ? "-" : f, false, false);
+  if (not maybeBuffer) {
+    *diag << "cannot open " << f << ": " << maybeBuffer.getError().message() << '\n';
+    return 1;
+  }
+  source = std::move(*maybeBuffer);
+  file = f;
+  if (parseJobs > 1 && not stream)  // Streaming needs definitions in order
+    return parseParallel();
+  return parseSource();
+}
+
+int driver::parse (StringRef text, const std::string &name, unsigned line, unsigned column) {
+  source = MemoryBuffer::getMemBuffer(text, name, false);
+  file = name;
+  return parseSource(line, column);
+}
+
+int driver::parseSource(unsigned line, unsigned column) {
+  ast.reset();                 // Previous AST, if any, is released at once
+  root = nullptr;
+  location.initialize(&file, line, column);
+  if (use_flex) scan_begin();
+  else lexer.open(source->getBuffer());
+  int res;
+  if (use_pratt)
+    res = PrattParser(*this).parse();
+  else {
+    yy::parser parser(*this);  // Parser instantiation
+    parser.set_debug_level(trace_parsing);
+    parser.set_debug_stream(*trace);
+    res = parser.parse();      // Parser entry-point call
+  }
+  if (use_flex) scan_end();
+  else lexer.close();
+  source.reset();              // The AST keeps no pointer into the text
+  if (stream && !res)          // Calls to functions that never showed up
+    resolver.finish();
   return res;
 }
 
-void driver::codegen() {
-  root->codegen(*this);
+// Piece of an input made of whole top-level definitions
+struct SourceChunk {
+  StringRef text;
+  unsigned line, column;  // Of its first character
+};
+
+// Splits text after top-level ";" into about count chunks of at least
+// minSize bytes. Only brackets and comments need to be told apart for
+// that; if brackets do not balance there is a syntax error, and the whole
+// text is returned as one chunk for the parser to report it.
+static std::vector<SourceChunk> splitTopLevel(StringRef text, unsigned count, size_t minSize) {
+  std::vector<SourceChunk> chunks;
+  size_t target = std::max(minSize, text.size() / count);
+  const char *chunkStart = text.begin(), *lineStart = text.begin(), *end = text.end();
+  unsigned line = 1, chunkLine = 1, chunkColumn = 1;
+  int depth = 0;
+  for (const char *p = text.begin(); p < end; p++)
+    switch (*p) {
+    case '\n':
+      line++;
+      lineStart = p + 1;
+      break;
+    case '#':  // Up to the newline, which is counted by the next iteration
+      if (auto *eol = static_cast<const char*>(memchr(p, '\n', end - p))) p = eol - 1;
+      else p = end - 1;
+      break;
+    case '{': case '(': case '[':
+      depth++;
+      break;
+    case '}': case ')': case ']':
+      if (--depth < 0) return {{text, 1, 1}};
+      break;
+    case ';':
+      if (depth == 0 && size_t(p + 1 - chunkStart) >= target && end - (p + 1) >= (ptrdiff_t)minSize) {
+        chunks.push_back({StringRef(chunkStart, p + 1 - chunkStart), chunkLine, chunkColumn});
+        chunkStart = p + 1;
+        chunkLine = line;
+        chunkColumn = chunkStart - lineStart + 1;
+      }
+      break;
+    }
+  if (depth != 0) return {{text, 1, 1}};
+  chunks.push_back({StringRef(chunkStart, end - chunkStart), chunkLine, chunkColumn});
+  return chunks;
+}
+
+// Parses chunks of the input on parseJobs threads, each with a driver of its
+// own, and merges their ASTs in source order. Identifiers are interned by this
+// driver's table. Diagnostics are those of a sequential parse: the chunks'
+// ones up to the first chunk that fails, whose AST is then dropped.
+int driver::parseParallel() {
+  const size_t minChunk = 64 * 1024;  // Smaller inputs are not worth a thread
+  auto chunks = splitTopLevel(source->getBuffer(), parseJobs, minChunk);
+  if (chunks.size() < 2)
+    return parseSource();
+
+  ast.reset();
+  root = nullptr;
+  struct Piece {
+    driver drv;
+    std::ostringstream diag, trace;
+    int res = 0;
+  };
+  std::vector<std::unique_ptr<Piece>> pieces(chunks.size());
+  {
+    ThreadPool pool(hardware_concurrency(parseJobs));
+    for (size_t i = 0; i < chunks.size(); i++)
+      pool.async([&, i] {
+        auto piece = std::make_unique<Piece>();
+        driver &worker = piece->drv;
+        worker.names.forwardTo(names);
+        worker.trace_parsing = trace_parsing;
+        worker.trace_scanning = trace_scanning;
+        worker.use_flex = use_flex;
+        worker.use_pratt = use_pratt;
+        worker.diag = &piece->diag;
+        worker.trace = &piece->trace;
+        piece->res = worker.parse(chunks[i].text, file, chunks[i].line, chunks[i].column);
+        pieces[i] = std::move(piece);
+      });
+    pool.wait();
+  }
+
+  int res = 0;
+  std::vector<RootAST*> tops;
+  for (auto &piece : pieces) {
+    *diag << piece->diag.str();
+    *trace << piece->trace.str();
+    if ((res = piece->res)) break;
+    auto &elems = cast<SeqAST>(piece->drv.root)->getElems();
+    tops.insert(tops.end(), elems.begin(), elems.end());
+    ast.absorb(piece->drv.ast);
+  }
+  if (res == 0)
+    root = ast.make<SeqAST>(std::move(tops));
+  else
+    ast.reset();
+  source.reset();
+  return res;
+}
+
+yy::parser::symbol_type yylex (driver& drv) {
+  return drv.use_flex ? flexlex(drv, drv.scanner) : drv.lexer.next(drv);
+}
+
+bool driver::codegen() {
+  unsigned before = errors;
+  generate(root);
+  return errors == before;
+};
+
+bool driver::streamTop(RootAST *top) {
+  if (!stream)
+    return false;
+  unsigned before = errors;
+  Value *V = generate(top);
+  if (errors == before)
+    if (auto *GV = dyn_cast_or_null<GlobalValue>(V))
+      stream(GV);
+  // Nothing else left on the parser stack points into the arena
+  ast.reset();
+  return true;
+};
+
+bool driver::analyze(RootAST *N) {
+  if (!resolver.resolve(N))
+    return false;
+  Simplifier(ast, fast_math).run(N);
+  TypeInference(resolver).run(N);
+  return true;
+};
+
+Value *driver::generate(RootAST *N) {
+  if (!analyze(N))
+    return nullptr;
+  return generateResolved(N);
+};
+
+Value *driver::generateResolved(RootAST *N) {
+  // Slots for everything declared so far, in this input or in previous ones
+  unit.functions.resize(resolver.functions.size());
+  unit.globals.resize(resolver.globals.size());
+  return N->codegen(*this);
+};
+
+bool driver::resolve() {
+  return analyze(root);
+};
+
+bool driver::lower(RootAST *N) {
+  unsigned before = errors;
+  generateResolved(N);
+  return errors == before;
+};
+
+void driver::shareResolution(const driver &from) {
+  resolver.functions = from.resolver.functions;
+  resolver.globals = from.resolver.globals;
+  file = from.file;
+  location = from.location;  // Diagnostics without a location of their own point there
+};
+
+void driver::rebindUnit() {
+  // The linker replaces declarations with the definitions it brings in
+  auto &module = *unit.module;
+  unit.functions.resize(resolver.functions.size());
+  unit.globals.resize(resolver.globals.size());
+  for (unsigned i = 0; i < unit.functions.size(); i++)
+    unit.functions[i] = module.getFunction(resolver.functions[i].name.str());
+  for (unsigned i = 0; i < unit.globals.size(); i++)
+    unit.globals[i] = module.getGlobalVariable(resolver.globals[i].name.str());
+};
+
+
+// Non-virtual dispatch: the kind tells which class the node really is
+Value *RootAST::codegen(driver& drv) {
+  switch (Kind) {
+  case ASTKind::Seq:        return static_cast<SeqAST*>(this)->codegen(drv);
+  case ASTKind::Number:     return static_cast<NumberExprAST*>(this)->codegen(drv);
+  case ASTKind::Variable:   return static_cast<VariableExprAST*>(this)->codegen(drv);
+  case ASTKind::Slicing:    return static_cast<SlicingExprAST*>(this)->codegen(drv);
+  case ASTKind::Binary:     return static_cast<BinaryExprAST*>(this)->codegen(drv);
+  case ASTKind::Call:       return static_cast<CallExprAST*>(this)->codegen(drv);
+  case ASTKind::If:         return static_cast<IfExprAST*>(this)->codegen(drv);
+  case ASTKind::Block:      return static_cast<BlockExprAST*>(this)->codegen(drv);
+  case ASTKind::VarBinding: return static_cast<VarBindingAST*>(this)->codegen(drv);
+  case ASTKind::Prototype:  return static_cast<PrototypeAST*>(this)->codegen(drv);
+  case ASTKind::Function:   return static_cast<FunctionAST*>(this)->codegen(drv);
+  case ASTKind::GlobalVar:  return static_cast<GlobalVarAST*>(this)->codegen(drv);
+  case ASTKind::Assignment: return static_cast<AssignmentExprAST*>(this)->codegen(drv);
+  case ASTKind::For:        return static_cast<ForExprAST*>(this)->codegen(drv);
+  case ASTKind::While:      return static_cast<WhileExprAST*>(this)->codegen(drv);
+  case ASTKind::Break:
+  case ASTKind::Continue:   return static_cast<JumpExprAST*>(this)->codegen(drv);
+  case ASTKind::Return:     return static_cast<ReturnExprAST*>(this)->codegen(drv);
+  }
+  return nullptr;
+};
+
+Value *ExprAST::codegenAs(driver& drv, ValueType t) {
+  Value *v = codegen(drv);
+  return v ? convert(*drv.unit.builder, v, Ty, t) : nullptr;
+};
+
+// A call is in tail position when the function returns its value as is: the
+// value of the body or of a return, either arm of an if or the last element
+// of a block in tail position, and no conversion in between
+void ExprAST::markTail(ValueType ret) {
+  switch (getKind()) {
+  case ASTKind::Call:  return static_cast<CallExprAST*>(this)->markTail(ret);
+  case ASTKind::If:    return static_cast<IfExprAST*>(this)->markTail(ret);
+  case ASTKind::Block: return static_cast<BlockExprAST*>(this)->markTail(ret);
+  default:
+    return;
+  }
 };
 
+// What follows a jump in the same block is unreachable: it is generated
+// into a new block, without predecessors
+static void startUnreachable(driver &drv, const char *name) {
+  auto &builder = drv.unit.builder;
+  auto *function = builder->GetInsertBlock()->getParent();
+  builder->SetInsertPoint(BasicBlock::Create(*drv.unit.context, name, function));
+}
 
-SeqAST::SeqAST(RootAST* first, RootAST* continuation):
-  first(first), continuation(continuation) {};
+// Whether E leaves its block by a jump, so that the block has no value
+static bool jumpsAway(const RootAST *E) {
+  if (auto *call = dyn_cast<CallExprAST>(E))
+    return call->isTail();
+  if (auto *block = dyn_cast<BlockExprAST>(E)) {
+    auto &elems = block->getSeq()->getElems();
+    return not elems.empty() && jumpsAway(elems.back());
+  }
+  return isa<JumpExprAST>(E) || isa<ReturnExprAST>(E);
+}
+
+
+SeqAST::SeqAST(std::vector<RootAST*> elems):
+  RootAST(ASTKind::Seq), elems(std::move(elems)) {};
 
 Value *SeqAST::codegen(driver& drv) {
   Value *v = nullptr;
-  
-  if (first) v = first->codegen(drv);
-  if (continuation) v = continuation->codegen(drv);
+  for (auto elem : elems)
+    v = elem->codegen(drv);
   return v;
 };
 
 
-NumberExprAST::NumberExprAST(double Val) : Val(Val) {};
+NumberExprAST::NumberExprAST(double Val, bool Folded) : ExprAST(ASTKind::Number), Val(Val), Folded(Folded) {};
 
 lexval NumberExprAST::getLexVal() const {
   lexval lval = Val;
@@ -46,11 +328,13 @@ lexval NumberExprAST::getLexVal() const {
 
 // Returns a constant value; uniqueness guaranteed by the context.
 Value *NumberExprAST::codegen(driver& drv) {  
+  auto &context = drv.unit.context;
+  if (Ty == ValueType::Integral) return ConstantInt::get(Type::getInt64Ty(*context), (int64_t)Val, true);
   return ConstantFP::get(*context, APFloat(Val));
 };
 
 
-VariableExprAST::VariableExprAST(const std::string &Name) : Name(Name) {};
+VariableExprAST::VariableExprAST(Ident Name, SourceLoc Loc) : ExprAST(ASTKind::Variable), Name(Name), Loc(Loc) {};
 
 lexval VariableExprAST::getLexVal() const {
   lexval lval = Name;
@@ -58,21 +342,19 @@ lexval VariableExprAST::getLexVal() const {
 };
 
 Value* SlicingExprAST::codegen(driver &drv) {
-  auto *idxVal = IdxExpr->codegen(drv);
+  auto *idxVal = IdxExpr->codegenAs(drv, ValueType::Int);
   if (not idxVal) return logError("Error while generating index expression", drv);
 
   return VariableExprAST::codegen(drv, idxVal);
 }
 
 Value* VariableExprAST::codegen(driver &drv, Value *idx) {
-  auto _logError = std::bind(logError, std::placeholders::_1, drv);
-  auto maybeSymbol = tryGetSymbol(drv, Name);
-  if (not maybeSymbol) return _logError("Symbol not found");
-
-  auto symbol = *maybeSymbol;
+  auto &builder = drv.unit.builder;
+  auto _logError = [&drv](const std::string &msg) { return logError(msg, drv); };
+  auto symbol = getSymbol(drv, B);
   if (not idx) {  // Scalar
-    if (auto *A = std::get_if<AllocaInst*>(&symbol)) return builder->CreateLoad((*A)->getAllocatedType(), *A, Name.c_str());
-    if (auto *G = std::get_if<GlobalVariable*>(&symbol)) return builder->CreateLoad((*G)->getValueType(), *G, Name.c_str());
+    if (auto *A = std::get_if<AllocaInst*>(&symbol)) return builder->CreateLoad((*A)->getAllocatedType(), *A, Name.str());
+    if (auto *G = std::get_if<GlobalVariable*>(&symbol)) return builder->CreateLoad((*G)->getValueType(), *G, Name.str());
   }
   else {  // Array
     auto *symbolType = dyn_cast<ArrayType>(getSymbolType(symbol));
@@ -80,31 +362,112 @@ Value* VariableExprAST::codegen(driver &drv, Value *idx) {
 
     Value *elem;
     if (auto *A = std::get_if<AllocaInst*>(&symbol))
-      elem = builder->CreateInBoundsGEP(symbolType, *A, {builder->getInt32(0), toInt(idx)});
+      elem = builder->CreateInBoundsGEP(symbolType, *A, {builder->getInt32(0), idx});
     
     if (auto *G = std::get_if<GlobalVariable*>(&symbol))
-      elem = builder->CreateInBoundsGEP(symbolType, *G, {builder->getInt32(0), toInt(idx)});
+      elem = builder->CreateInBoundsGEP(symbolType, *G, {builder->getInt32(0), idx});
 
-    return builder->CreateLoad(symbolType->getElementType(), elem, Name.c_str());
+    return builder->CreateLoad(symbolType->getElementType(), elem, Name.str());
   }
 
   return _logError("Symbol not suitable");
 }
 
 BinaryExprAST::BinaryExprAST(char Op, ExprAST* LHS, ExprAST* RHS) :
-  Op(Op), LHS(LHS), RHS(RHS) {};
+  ExprAST(ASTKind::Binary), Op(Op), LHS(LHS), RHS(RHS) {};
+
+// Whether E can be evaluated even when its value is not needed: it has no
+// side effects and cannot fault (array subscripts may be out of bounds)
+static bool isSpeculatable(const ExprAST *E) {
+  switch (E->getKind()) {
+  case ASTKind::Number:
+  case ASTKind::Variable:
+    return true;
+  case ASTKind::Binary: {
+    auto *B = static_cast<const BinaryExprAST*>(E);
+    return isSpeculatable(B->getLHS()) && (not B->getRHS() || isSpeculatable(B->getRHS()));
+  }
+  default:
+    return false;
+  }
+}
 
-Value *BinaryExprAST::codegen(driver& drv) {
+// "and" and "or" evaluate their right operand only when the left one does not
+// settle the result. When evaluating it anyway is harmless, the result is a
+// select instead of a branch.
+Value *BinaryExprAST::codegenLogical(driver& drv) {
+  auto &context = drv.unit.context;
+  auto &builder = drv.unit.builder;
+  bool isAnd = Op == '&';
   Value *L = LHS->codegen(drv);
+  if (!L)
+    return nullptr;
+
+  if (isSpeculatable(RHS)) {
+    Value *R = RHS->codegen(drv);
+    if (!R)
+      return nullptr;
+    return isAnd ? builder->CreateLogicalAnd(L, R, "landres") : builder->CreateLogicalOr(L, R, "lorres");
+  }
+
+  Function *function = builder->GetInsertBlock()->getParent();
+  BasicBlock *LeftBB = builder->GetInsertBlock();
+  BasicBlock *RightBB = BasicBlock::Create(*context, isAnd ? "landrhs" : "lorrhs", function);
+  BasicBlock *MergeBB = BasicBlock::Create(*context, isAnd ? "landend" : "lorend");
+  if (isAnd) builder->CreateCondBr(L, RightBB, MergeBB);
+  else builder->CreateCondBr(L, MergeBB, RightBB);
+
+  builder->SetInsertPoint(RightBB);
+  Value *R = RHS->codegen(drv);
+  if (!R)
+    return nullptr;
+  builder->CreateBr(MergeBB);
+  RightBB = builder->GetInsertBlock();  // The right operand may have added blocks
+
+  function->insert(function->end(), MergeBB);
+  builder->SetInsertPoint(MergeBB);
+  PHINode *PN = builder->CreatePHI(builder->getInt1Ty(), 2, isAnd ? "landres" : "lorres");
+  PN->addIncoming(builder->getInt1(not isAnd), LeftBB);
+  PN->addIncoming(R, RightBB);
+  return PN;
+}
+
+Value *BinaryExprAST::codegen(driver& drv) {
+  auto &builder = drv.unit.builder;
+  if (Op == '&' || Op == '|')
+    return codegenLogical(drv);
+
+  ValueType operands = operandType();
+  Value *L = LHS->codegenAs(drv, operands);
   Value *R = nullptr;
-  if (RHS) R = RHS->codegen(drv);
+  if (RHS) R = RHS->codegenAs(drv, operands);
 
-  if (!L || (R && !R)) 
+  if (!L || (RHS && !R))
     return nullptr;
+  // Integer doubles only get here for sums, differences and comparisons, see operandType
+  if (isInteger(operands))
+    switch (Op) {
+    case '+':
+      return builder->CreateAdd(L, R, "addres");
+    case '-':
+      if (not RHS)
+        return builder->CreateNeg(L, "negres");
+      return builder->CreateSub(L, R, "subres");
+    case '*':
+      return builder->CreateMul(L, R, "mulres");
+    case '<':
+      return builder->CreateICmpSLT(L, R, "lttest");
+    case '>':
+      return builder->CreateICmpSGT(L, R, "gttest");
+    case '=':
+      return builder->CreateICmpEQ(L, R, "eqtest");
+    }
   switch (Op) {
   case '+':
     return builder->CreateFAdd(L,R,"addres");
   case '-':
+    if (not RHS)  // Negation
+      return builder->CreateFNeg(L, "negres");
     return builder->CreateFSub(L, R, "subres");
   case '*':
     return builder->CreateFMul(L, R, "mulres");
@@ -118,10 +481,6 @@ Value *BinaryExprAST::codegen(driver& drv) {
     return builder->CreateFCmpUEQ(L, R, "eqtest");
   case '!':  // Logical not
     return builder->CreateNot(L, "lnotres");
-  case '&':  // Logical and
-    return builder->CreateAnd(L, R, "landres");
-  case '|':  // Logical or
-    return builder->CreateOr(L, R, "lorres");
   default:
     using namespace std::string_literals;
     return logError(std::to_string(Op) + " operatore binario non supportato", drv);
@@ -129,8 +488,8 @@ Value *BinaryExprAST::codegen(driver& drv) {
 };
 
 
-CallExprAST::CallExprAST(std::string Callee, std::vector<ExprAST*> Args) :
-  Callee(Callee),  Args(std::move(Args)) {};
+CallExprAST::CallExprAST(Ident Callee, std::vector<ExprAST*> Args, SourceLoc Loc) :
+  ExprAST(ASTKind::Call), Callee(Callee),  Args(std::move(Args)), Loc(Loc) {};
 
 lexval CallExprAST::getLexVal() const {
   lexval lval = Callee;
@@ -138,27 +497,58 @@ lexval CallExprAST::getLexVal() const {
 };
 
 Value* CallExprAST::codegen(driver& drv) {
-  Function *CalleeF = module->getFunction(Callee);
-  if (!CalleeF)  // Function existance check
-    return logError("Funzione non definita", drv);
+  auto &builder = drv.unit.builder;
+  // Existence and number of arguments were checked by the resolver
+  Function *CalleeF = getFunction(drv, B.index);
 
-  if (CalleeF->arg_size() != Args.size())  // Params number check
-    return logError("Numero di argomenti non corretto", drv);
+  auto &params = drv.resolver.functions[B.index].params;
 
   std::vector<Value *> ArgsV;
-  for (auto arg : Args) {
-    ArgsV.push_back(arg->codegen(drv));
+  for (unsigned i = 0; i < Args.size(); i++) {
+    ArgsV.push_back(Args[i]->codegenAs(drv, params[i]));
     if (!ArgsV.back())
       return nullptr;
   }
-  return builder->CreateCall(CalleeF, ArgsV, "calltmp");
+  if (Tail && B.index == drv.unit.function) {
+    // Self tail call: the arguments, all evaluated first, take the new values
+    // and the body starts over; no stack is used, even without optimizations
+    for (unsigned i = 0; i < ArgsV.size(); i++)
+      builder->CreateStore(ArgsV[i], drv.unit.frame[i]);
+    builder->CreateBr(drv.unit.tailRecurse);
+    startUnreachable(drv, "aftertailcall");
+    return UndefValue::get(getLLVMType(*drv.unit.context, Ty));
+  }
+
+  CallInst *call = builder->CreateCall(CalleeF, ArgsV, "calltmp");
+  if (not Tail)
+    return call;
+  Function *caller = builder->GetInsertBlock()->getParent();
+  if (CalleeF->getFunctionType() != caller->getFunctionType()) {
+    call->setTailCall();  // Only a hint: the backend may still need a new frame
+    return call;
+  }
+  // Same signature: the callee reuses the caller's frame, which musttail
+  // guarantees as long as the ret follows right away
+  call->setTailCallKind(CallInst::TCK_MustTail);
+  builder->CreateRet(call);
+  startUnreachable(drv, "aftertailcall");
+  return UndefValue::get(getLLVMType(*drv.unit.context, Ty));
 }
 
 
 IfExprAST::IfExprAST(ExprAST* Cond, ExprAST* TrueExp, ExprAST* FalseExp):
-   Cond(Cond), TrueExp(TrueExp), FalseExp(FalseExp) {};
+   ExprAST(ASTKind::If), Cond(Cond), TrueExp(TrueExp), FalseExp(FalseExp) {};
+
+void IfExprAST::markTail(ValueType ret) {
+  if (not FalseExp)  // The value is undefined, not the true arm's
+    return;
+  TrueExp->markTail(ret);
+  FalseExp->markTail(ret);
+};
    
 Value* IfExprAST::codegen(driver& drv) {
+  auto &context = drv.unit.context;
+  auto &builder = drv.unit.builder;
   Value* CondV = Cond->codegen(drv);
   if (!CondV)
       return nullptr;
@@ -173,7 +563,7 @@ Value* IfExprAST::codegen(driver& drv) {
   builder->CreateCondBr(CondV, TrueBB, FalseExp ? FalseBB : MergeBB);
   
   builder->SetInsertPoint(TrueBB);
-  Value *TrueV = TrueExp->codegen(drv);
+  Value *TrueV = FalseExp ? TrueExp->codegenAs(drv, Ty) : TrueExp->codegen(drv);
   if (not TrueV) return nullptr;
   builder->CreateBr(MergeBB);  // Inconditionally branch to MergeBB
   
@@ -185,7 +575,7 @@ Value* IfExprAST::codegen(driver& drv) {
   if (FalseExp) {
     function->insert(function->end(), FalseBB);
     builder->SetInsertPoint(FalseBB);
-    FalseV = FalseExp->codegen(drv);
+    FalseV = FalseExp->codegenAs(drv, Ty);
     if (!FalseV)
       return nullptr;
     
@@ -197,7 +587,7 @@ Value* IfExprAST::codegen(driver& drv) {
   builder->SetInsertPoint(MergeBB);
   
   if (FalseExp) {
-    PHINode *PN = builder->CreatePHI(Type::getDoubleTy(*context), 2, "condval");
+    PHINode *PN = builder->CreatePHI(getLLVMType(*context, Ty), 2, "condval");
     PN->addIncoming(TrueV, TrueBB);
     if (FalseExp) PN->addIncoming(FalseV, FalseBB);
     return PN;
@@ -208,80 +598,80 @@ Value* IfExprAST::codegen(driver& drv) {
 
 
 BlockExprAST::BlockExprAST(std::vector<VarBindingAST*> Def, SeqAST* Seq) : 
-  Def(std::move(Def)), Seq(Seq) {};
+  ExprAST(ASTKind::Block), Def(std::move(Def)), Seq(Seq) {};
+
+void BlockExprAST::markTail(ValueType ret) {
+  auto &elems = Seq->getElems();
+  if (elems.empty()) return;
+  if (auto *last = dyn_cast<ExprAST>(elems.back()))
+    last->markTail(ret);
+};
 
 Value* BlockExprAST::codegen(driver& drv) {
-  // BlockExprAST is in charge of managing the visibility of bindings and variables through the symbol table.
+  // Visibility of bindings was settled by the resolver: each one has its own frame slot.
   // Allocations are placed in the function's entry block.
-
-  // Current scope is saved before shadowing is applied.
-  std::vector<AllocaInst*> AllocaTmp;
-
-  for (auto &def : Def) {
-    const auto &name = def->getName();
-    AllocaInst *boundval = def->codegen(drv);
-
-    if (!boundval) 
+  for (auto &def : Def)
+    if (!def->codegen(drv))
       return nullptr;
 
-    AllocaTmp.push_back(drv.NamedValues[name]);
-    drv.NamedValues[name] = boundval;
-  };
-
   Value *blockvalue = Seq->codegen(drv);
-  
+
   if (!blockvalue) {
     return logError("Invalid block sequence", drv);
   }
 
-  if (isa<UndefValue>(blockvalue)) {
+  // A block ending with a jump has no value of its own to give
+  RootAST *last = Seq->getElems().back();
+  if (isa<UndefValue>(blockvalue) && not jumpsAway(last)) {
     logWarning("Uncomplete or invalid block expression. Expanding as undef.", drv);
   }
 
-// Previous scope is restored
-  for (int i=0; auto &def : Def) {
-    drv.NamedValues[def->getName()] = AllocaTmp[i++];
-  };
-
   return blockvalue;
 };
 
 
-VarBindingAST::VarBindingAST(const std::string Name, ExprAST* Val) :
-  Name(Name), Val(Val), InitializerList({}), Size(0) {};
+VarBindingAST::VarBindingAST(Ident Name, ExprAST* Val, std::optional<ValueType> Declared) :
+  RootAST(ASTKind::VarBinding), Name(Name), Size(0), Val(Val), InitializerList({}), Declared(Declared) {};
 
-VarBindingAST::VarBindingAST(const std::string Name, std::vector<ExprAST*> InitializerList, unsigned Size) :
-  Name(Name), Val(nullptr), InitializerList(InitializerList), Size(Size) {};
+VarBindingAST::VarBindingAST(Ident Name, std::vector<ExprAST*> InitializerList, unsigned Size,
+                             std::optional<ValueType> Declared) :
+  RootAST(ASTKind::VarBinding), Name(Name), Size(Size), Val(nullptr), InitializerList(std::move(InitializerList)),
+  Declared(Declared) {};
    
-std::string VarBindingAST::getName() const { 
+Ident VarBindingAST::getName() const { 
   return Name;  
 };
 
 AllocaInst* VarBindingAST::codegen(driver& drv) {
+  auto &context = drv.unit.context;
+  auto &builder = drv.unit.builder;
   // Get current function to allocate memory in its activation record
   Function *fun = builder->GetInsertBlock()->getParent();
   AllocaInst *Alloca = nullptr;
 
   if (Size == 0) {  // Scalar
     // Bindings without rhs can exist in order to shadow global vars
-    if (not Val) Val = new NumberExprAST(0);
-
-    Value *BoundVal = Val->codegen(drv);  // Generate value
-    if (!BoundVal) logError("Failed to generate RHS expression for variable binding", drv);
+    Type *type = getLLVMType(*context, Ty);
+    Value *BoundVal = Val ? Val->codegenAs(drv, Ty) : Constant::getNullValue(type);  // Generate value
+    if (!BoundVal) {
+      logError("Failed to generate RHS expression for variable binding", drv);
+      return nullptr;
+    }
 
-    Alloca = CreateEntryBlockAlloca(fun, this->getName());
+    Alloca = CreateEntryBlockAlloca(fun, Name.str(), type);
     builder->CreateStore(BoundVal, Alloca);
   }
   else {  // Array
-    auto *arrayType = ArrayType::get(Type::getDoubleTy(*context), Size);
+    auto *arrayType = ArrayType::get(getLLVMType(*context, Ty), Size);
     Alloca = CreateEntryBlockAlloca(
       fun,
-      this->getName(),
+      Name.str(),
       arrayType
     );
 
-    for (int i = 0; i < Size; ++i) {
-      auto *initVal = InitializerList[i]->codegen(drv);
+    // Extra initializers are ignored, missing ones leave the elements undefined
+    for (unsigned i = 0; i < Size && i < InitializerList.size(); ++i) {
+      auto *initVal = InitializerList[i]->codegenAs(drv, Ty);
       if (not initVal) {
         logError(
           "Failed to generate expression value for element" + std::to_string(i) + "of the initializer list",
@@ -300,127 +690,97 @@ AllocaInst* VarBindingAST::codegen(driver& drv) {
     }
 
     using namespace std::string_literals;
-    if (InitializerList.size() < Size) logWarning("Uninitialized elements of "s + this->getName(), drv);
-    if (InitializerList.size() > Size) logWarning("Initializer list longer than array "s + this->getName(), drv);
+    if (InitializerList.size() < Size) logWarning("Uninitialized elements of "s + Name.str().str(), drv);
+    if (InitializerList.size() > Size) logWarning("Initializer list longer than array "s + Name.str().str(), drv);
   }
 
+  drv.unit.frame[Slot] = Alloca;
   return Alloca;
 };
 
 
-PrototypeAST::PrototypeAST(std::string Name, std::vector<std::string> Args) :
-  Name(Name), Args(std::move(Args)), emitcode(true) {};
+PrototypeAST::PrototypeAST(Ident Name, std::vector<Param> Params, ValueType RetType, SourceLoc Loc) :
+  RootAST(ASTKind::Prototype), Name(Name), Params(std::move(Params)), RetType(RetType), Loc(Loc) {};
 
 lexval PrototypeAST::getLexVal() const {
   lexval lval = Name;
   return lval;	
 };
 
-const std::vector<std::string>& PrototypeAST::getArgs() const { 
-   return Args;
-};
-
-// Prevents double code emission: see PrototypeAST and FunctionAST
-void PrototypeAST::noemit() { 
-   emitcode = false; 
-};
-
 Function *PrototypeAST::codegen(driver& drv) {
-  // Define args vector and function type (retval, argsval).
-  std::vector<Type*> Doubles(Args.size(), Type::getDoubleTy(*context));
-  FunctionType *FT = FunctionType::get(Type::getDoubleTy(*context), Doubles, false);
-  Function *F = Function::Create(FT, Function::ExternalLinkage, Name, *module);
+  // The function may already have been declared by a use or by another prototype
+  Function *F = getFunction(drv, Index);
 
   unsigned Idx = 0;
   for (auto &Arg : F->args())
-    Arg.setName(Args[Idx++]);
+    Arg.setName(Params[Idx++].name.str());
 
-  if (emitcode) {
-    F->print(errs());
-    fprintf(stderr, "\n");
-  };
-  
   return F;
 }
 
 
 FunctionAST::FunctionAST(PrototypeAST* Proto, ExprAST* Body) :
-  Proto(Proto), Body(Body) {};
+  RootAST(ASTKind::Function), Proto(Proto), Body(Body) {};
 
 Function *FunctionAST::codegen(driver& drv) {
-  Function *function = 
-    module->getFunction(std::get<std::string>(Proto->getLexVal()));
-
-  if (!function)
-    function = Proto->codegen(drv);
-  else
-    return nullptr;
-
-  if (!function)
-    return nullptr;  
-
+  auto &context = drv.unit.context;
+  auto &builder = drv.unit.builder;
+  // Completes the declaration made by an extern or by a call, possibly in
+  // another input file of the same module; redefinitions were rejected by the resolver
+  Function *function = Proto->codegen(drv);
 
   BasicBlock *BB = BasicBlock::Create(*context, "entry", function);
   builder->SetInsertPoint(BB);
   
+  // Arguments take the first slots of the frame
+  auto &frame = drv.unit.frame;
+  frame.assign(FrameSize, nullptr);
+  drv.unit.loops.clear();
+  unsigned Idx = 0;
   for (auto &Arg : function->args()) {
-    AllocaInst *Alloca = CreateEntryBlockAlloca(function, Arg.getName());
+    AllocaInst *Alloca = CreateEntryBlockAlloca(function, Arg.getName(), Arg.getType());
     builder->CreateStore(&Arg, Alloca);
-    drv.NamedValues[std::string(Arg.getName())] = Alloca;
+    frame[Idx++] = Alloca;
   } 
-  
-  if (Value *RetVal = Body->codegen(drv)) {
+
+  // Self tail calls store the arguments and jump back here, past the allocas
+  drv.unit.function = Proto->getIndex();
+  drv.unit.tailRecurse = BasicBlock::Create(*context, "tailrecurse", function);
+  builder->CreateBr(drv.unit.tailRecurse);
+  builder->SetInsertPoint(drv.unit.tailRecurse);
+
+  Body->markTail(Proto->getRetType());
+  Value *RetVal = Body->codegenAs(drv, Proto->getRetType());
+
+  if (RetVal) {
     // If body generation is good, get return value and add a return instruction
     builder->CreateRet(RetVal);
+    // Without self tail calls the loop header is just the rest of the entry block
+    MergeBlockIntoPredecessor(drv.unit.tailRecurse);
 
     // Consistency control
     verifyFunction(*function);
-
-    // Emit code
-    function->print(errs());
-    fprintf(stderr, "\n");
     return function;
   }
 
-  // If some error occurred in function's emission
-  function->eraseFromParent();
+  // If some error occurred in function's emission the body is dropped;
+  // the declaration stays, as the unit's function table refers to it
+  function->deleteBody();
   return nullptr;
 };
 
 
 GlobalVariable* GlobalVarAST::codegen(driver &drv) {
-  Type *t;
-  Constant *init;
-  if (size == 0) {
-    t = Type::getDoubleTy(*context);
-    init = ConstantFP::getZero(Type::getDoubleTy(*context));
-  }
-  else {
-    t = ArrayType::get(Type::getDoubleTy(*context), size);
-    init = ConstantFP::getNullValue(t);
-  }
-
-
-  auto *globalVar = new GlobalVariable(
-    *module,
-    t,
-    false,  // Not constant
-    GlobalValue::LinkageTypes::CommonLinkage,
-    init,
-    name
-  );
-
-  globalVar->print(errs()); errs() << "\n";
-
-  return globalVar;
+  // Uses may have come first: the global is defined once, whichever is seen first
+  return getGlobal(drv, index);
 };
 
 Value* AssignmentExprAST::codegen(driver &drv) {
-  auto maybeSymbol = tryGetSymbol(drv, name);
-  if (not maybeSymbol) return logError("Not defined variable", drv);
-  auto symbol = *maybeSymbol;
+  auto &builder = drv.unit.builder;
+  auto symbol = getSymbol(drv, b);
 
-  Value *v = val->codegen(drv);
+  // The stored value takes the type of the variable, or of array elements
+  Value *v = val->codegenAs(drv, Ty);
   if (not v) return logError("Failed to create assignment val", drv);
 
   if (not idxExpr) {  // Scalar
@@ -435,7 +795,7 @@ Value* AssignmentExprAST::codegen(driver &drv) {
     }
   }
   else {  // Array
-    auto *idxVal = toInt(idxExpr->codegen(drv));
+    auto *idxVal = idxExpr->codegenAs(drv, ValueType::Int);
     if (not idxVal) return logError("Cannot generate index val", drv);
 
     if (not isa<ArrayType>(getSymbolType(symbol))) return logError("Unsupported slicing", drv);
@@ -455,13 +815,15 @@ Value* AssignmentExprAST::codegen(driver &drv) {
 }
 
 Value* ForExprAST::codegen(driver &drv) {
+  auto &context = drv.unit.context;
+  auto &builder = drv.unit.builder;
   auto *function = builder->GetInsertBlock()->getParent();
   
-  auto addBlock = [&function] (BasicBlock *bb) -> void {
+  auto addBlock = [&function, &builder] (BasicBlock *bb) -> void {
     function->insert(function->end(), bb);
     builder->SetInsertPoint(bb);
   };
-  auto _logError = std::bind(logError, std::placeholders::_1, drv);
+  auto _logError = [&drv](const std::string &msg) { return logError(msg, drv); };
 
   // Loop building blocks
   auto *preheaderBB = BasicBlock::Create(*context, "preheader");
@@ -477,23 +839,16 @@ Value* ForExprAST::codegen(driver &drv) {
   if (not initRes) return _logError("Error while creating preheader");
   builder->CreateBr(headerBB);
 
-  // Freeze scope
-  AllocaInst *prevInitScope = nullptr;
-  const std::string &initName = init->getName();
-  auto bindAlloca = dyn_cast<AllocaInst>(initRes);
-  const bool isInitBound = bindAlloca != nullptr;
-  if (isInitBound) {
-    prevInitScope = drv.NamedValues[initName];
-    drv.NamedValues[initName] = bindAlloca;
-  }
-
   addBlock(headerBB);
   Value *condVal = cond->codegen(drv);
   if (not condVal) return _logError("Error while creating condition expression");
   builder->CreateCondBr(condVal, bodyBB, exitBB);
 
   addBlock(bodyBB);
-  if (not body->codegen(drv)) return _logError("Error while generating body");
+  drv.unit.loops.push_back({exitBB, latchBB});
+  bool bodyRes = body->codegen(drv);
+  drv.unit.loops.pop_back();
+  if (not bodyRes) return _logError("Error while generating body");
   builder->CreateBr(latchBB);
 
   addBlock(latchBB);
@@ -501,10 +856,62 @@ Value* ForExprAST::codegen(driver &drv) {
     return _logError("Error while generating assignment");
   builder->CreateBr(headerBB);
 
-  // Restore scope
-  if (isInitBound) drv.NamedValues[initName] = prevInitScope;
+  addBlock(exitBB);
+
+  return UndefValue::get(Type::getDoubleTy(*context));
+}
+Value* WhileExprAST::codegen(driver &drv) {
+  auto &context = drv.unit.context;
+  auto &builder = drv.unit.builder;
+  auto *function = builder->GetInsertBlock()->getParent();
+
+  auto addBlock = [&function, &builder] (BasicBlock *bb) -> void {
+    function->insert(function->end(), bb);
+    builder->SetInsertPoint(bb);
+  };
+  auto _logError = [&drv](const std::string &msg) { return logError(msg, drv); };
+
+  // Loop building blocks: continue goes back to the header
+  auto *headerBB = BasicBlock::Create(*context, "header");
+  auto *bodyBB = BasicBlock::Create(*context, "body");
+  auto *exitBB = BasicBlock::Create(*context, "exit");
+
+  builder->CreateBr(headerBB);
+
+  addBlock(headerBB);
+  Value *condVal = cond->codegen(drv);
+  if (not condVal) return _logError("Error while creating condition expression");
+  builder->CreateCondBr(condVal, bodyBB, exitBB);
+
+  addBlock(bodyBB);
+  drv.unit.loops.push_back({exitBB, headerBB});
+  bool bodyRes = body->codegen(drv);
+  drv.unit.loops.pop_back();
+  if (not bodyRes) return _logError("Error while generating body");
+  builder->CreateBr(headerBB);
 
   addBlock(exitBB);
 
   return UndefValue::get(Type::getDoubleTy(*context));
-}
\ No newline at end of file
+}
+
+Value* JumpExprAST::codegen(driver &drv) {
+  auto &builder = drv.unit.builder;
+  // The resolver checked there is a loop around
+  auto [exitBB, continueBB] = drv.unit.loops.back();
+  bool isBreak = getKind() == ASTKind::Break;
+  builder->CreateBr(isBreak ? exitBB : continueBB);
+  startUnreachable(drv, isBreak ? "afterbreak" : "aftercontinue");
+  return UndefValue::get(Type::getDoubleTy(*drv.unit.context));
+}
+
+Value* ReturnExprAST::codegen(driver &drv) {
+  auto &builder = drv.unit.builder;
+  val->markTail(retType);
+  Value *v = val->codegenAs(drv, retType);
+  if (not v) return logError("Failed to create return val", drv);
+  // Returns on the spot: a common return block would only be merged back
+  builder->CreateRet(v);
+  startUnreachable(drv, "afterreturn");
+  return UndefValue::get(Type::getDoubleTy(*drv.unit.context));
+}
@@ -3,7 +3,11 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <functional>
+#include <iostream>
 #include <map>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 #include <variant>
@@ -20,79 +24,214 @@
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/GlobalValue.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/Support/MemoryBuffer.h"
 
+#include "arena.hpp"
+#include "symbols.hpp"
+#include "resolver.hpp"
+#include "simplifier.hpp"
+#include "inference.hpp"
 #include "parser.hpp"
+#include "lexer.hpp"
 
-# define YY_DECL yy::parser::symbol_type yylex (driver& drv)
+// The parser pulls tokens from yylex, which hands over to the hand-written lexer
+// (lexer.cpp) or to the flex scanner (scanner.ll, whose entry point is flexlex).
+// The flex scanner is reentrant: its state is behind yyscanner, one per driver.
+# define YY_DECL yy::parser::symbol_type flexlex (driver& drv, void *yyscanner)
 YY_DECL;
+yy::parser::symbol_type yylex (driver& drv);
 
 using namespace llvm;
 
+// Everything a single compilation lowers the AST into.
+// Units share no state, so independent ones can be generated concurrently.
+class CompilationUnit {
+public:
+  std::unique_ptr<LLVMContext> context;
+  std::unique_ptr<Module> module;
+  std::unique_ptr<IRBuilder<>> builder;
+  // What the resolver's slots are in this unit; globals and functions are
+  // declared on first use (see getGlobal and getFunction in utils.hpp)
+  std::vector<AllocaInst*> frame;  // Arguments and locals of the function being generated
+  // Where break and continue jump to in the loops being generated, innermost last
+  std::vector<std::pair<BasicBlock*, BasicBlock*>> loops;
+  unsigned function;  // Resolver index of the function being generated
+  BasicBlock *tailRecurse;  // Where its self tail calls jump back to, past the entry block
+  std::vector<GlobalVariable*> globals;
+  std::vector<Function*> functions;
+
+  CompilationUnit(const std::string &name = "Kaleidoscope");
+  // Goes on in a new empty module of the same context, where everything will be
+  // declared again on first use; returns the previous module
+  std::unique_ptr<Module> startModule(const std::string &name);
+};
+
 class driver {
 public:
-  std::map<std::string, AllocaInst*> NamedValues;  // Symbol table
+  CompilationUnit unit;  // Codegen target of this driver
+  Interner names;  // Owns the spelling of every identifier in the AST
+  Resolver resolver;  // Binds the names of the AST, see resolver.cpp
+  ASTArena ast;  // Owns every node of the current AST
   RootAST* root;  // AST root
-  std::string file;  // Input file
+  std::string file;  // Input file, or name of the source text
+  std::unique_ptr<MemoryBuffer> source;  // Text being parsed: mapped file, or caller's buffer
   bool trace_parsing;  // Parser debug tracing
   bool trace_scanning;  // Scanner debug tracing
+  bool use_flex;  // Scan with scanner.ll instead of the hand-written lexer
+  bool use_pratt;  // Parse with the hand-written parser (pratt.cpp) instead of parser.yy
+  bool fast_math;  // Let the simplifier apply rewrites that are not exact in IEEE arithmetic
+  unsigned parseJobs;  // Threads parsing a large input, see parseParallel
+  Lexer lexer;
+  void *scanner;  // State of the flex scanner, when scanning with it
+  StringRef flexInput;  // Part of source not yet read by the flex scanner
   yy::location location;  //  Tokens' location
+  unsigned errors;  // Semantic errors reported so far
+  std::ostream *diag;  // Where diagnostics are written
+  std::ostream *trace;  // Where parser and scanner traces are written
 
   driver();
   void scan_begin ();  // See scanner.ll
   void scan_end ();  // See scanner.ll
-  int parse (const std::string& f);
-  void codegen();
+  int parse (const std::string& f);  // Empty or "-" is stdin
+  // Text is not copied: it must outlive the call. It starts at line:column of name.
+  int parse (StringRef text, const std::string& name, unsigned line = 1, unsigned column = 1);
+  bool codegen();  // Analyzes and generates the AST; false if semantic errors were found
+
+  // The two halves of codegen(), for drivers generating parts of an AST resolved
+  // by another one: they share its resolver tables (see shareResolution)
+  bool resolve();  // Analyzes the AST; false if errors were reported
+  bool lower(RootAST *N);  // Generates N, already resolved, into unit
+  void shareResolution(const driver &from);
+  void rebindUnit();  // After other modules were linked into unit's: finds its symbols again
+
+  // Streaming mode: when set, each top-level definition is resolved and generated
+  // as soon as it is parsed, handed over here, and its AST released at once
+  std::function<void(GlobalValue*)> stream;
+  bool streamTop(RootAST *top);  // False when not streaming: the parser keeps top
+
+private:
+  int parseSource(unsigned line = 1, unsigned column = 1);
+  int parseParallel();
+  bool analyze(RootAST *N);  // Resolves, simplifies and infers the types of N
+  Value *generate(RootAST *N);
+  Value *generateResolved(RootAST *N);
 };
 
-typedef std::variant<std::string,double> lexval;
+typedef std::variant<Ident,double> lexval;
 const lexval NONE = 0.0;
 
+// Tag of every concrete node class. The AST has no vtables: traversals switch
+// on the kind and static_cast to the node class (see RootAST::codegen).
+// Subclasses that only specialize construction (UnaryExprAST, UnaryIncrementAST,
+// UnaryDecrementAST) share the kind of the class they derive from; JumpExprAST
+// has two kinds, Break and Continue.
+enum class ASTKind : unsigned char {
+  Seq,
+  Number,
+  Variable,
+  Slicing,
+  Binary,
+  Call,
+  If,
+  Block,
+  VarBinding,
+  Prototype,
+  Function,
+  GlobalVar,
+  Assignment,
+  For,
+  While,
+  Break,
+  Continue,
+  Return,
+};
+
 class RootAST {
+private:
+  const ASTKind Kind;
+
+protected:
+  RootAST(ASTKind Kind) : Kind(Kind) {};
+
 public:
-  virtual ~RootAST() {};
-  virtual lexval getLexVal() const { return NONE; };
-  virtual Value *codegen(driver& drv) { return nullptr; };
+  ASTKind getKind() const { return Kind; };
+  Value *codegen(driver& drv);  // Dispatches on the node kind
+  void resolve(Resolver &R);  // Dispatches on the node kind, see resolver.cpp
+  RootAST *simplify(Simplifier &S);  // Dispatches on the node kind, see simplifier.cpp
+  void infer(TypeInference &T);  // Dispatches on the node kind, see inference.cpp
 };
 
+// Sequence of statements or of top-level definitions; its value is the last one's
 class SeqAST : public RootAST {
 private:
-  RootAST* first;
-  RootAST* continuation;
+  std::vector<RootAST*> elems;
 
 public:
-  SeqAST(RootAST* first, RootAST* continuation);
-  Value *codegen(driver& drv) override;
+  SeqAST(std::vector<RootAST*> elems);
+  Value *codegen(driver& drv);
+  void resolve(Resolver &R);
+  void simplify(Simplifier &S);
+  void infer(TypeInference &T);
+  const std::vector<RootAST*> &getElems() const { return elems; };
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::Seq; };
 };
 
 
-class ExprAST : public RootAST {};
+class ExprAST : public RootAST {
+protected:
+  ValueType Ty = ValueType::Double;  // Set by type inference
+  ExprAST(ASTKind Kind) : RootAST(Kind) {};
 
-class InitAST : public RootAST {
 public:
-  virtual std::string getName() const = 0;
+  ValueType getType() const { return Ty; };
+  Value *codegenAs(driver& drv, ValueType t);  // Generates the value converted to t
+  void markTail(ValueType ret);  // Marks the calls in tail position, when this is the result of a function
+  static bool classof(const RootAST *N) {
+    switch (N->getKind()) {
+    case ASTKind::Seq: case ASTKind::VarBinding: case ASTKind::Prototype:
+    case ASTKind::Function: case ASTKind::GlobalVar:
+      return false;
+    default:
+      return true;
+    }
+  };
 };
 
 class NumberExprAST : public ExprAST {
 private:
   double Val;
+  bool Folded;  // Computed by the simplifier, not written in the source
 
 public:
-  NumberExprAST(double Val);
-  lexval getLexVal() const override;
-  Value *codegen(driver& drv) override;
+  NumberExprAST(double Val, bool Folded = false);
+  lexval getLexVal() const;
+  double getVal() const { return Val; };
+  bool isFolded() const { return Folded; };
+  Value *codegen(driver& drv);
+  void infer(TypeInference &T);
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::Number; };
 };
 
 class VariableExprAST : public ExprAST {
 private:
-  std::string Name;
+  Ident Name;
+  SourceLoc Loc;
+  Binding B;  // Set by the resolver
 
 protected:
+  VariableExprAST(ASTKind Kind, Ident Name, SourceLoc Loc) : ExprAST(Kind), Name(Name), Loc(Loc) {};
   Value* codegen(driver& drv, Value *idx);
   
 public:
-  VariableExprAST(const std::string &Name);
-  lexval getLexVal() const override;
-  Value* codegen(driver& drv) override { return VariableExprAST::codegen(drv, nullptr); };
+  VariableExprAST(Ident Name, SourceLoc Loc);
+  lexval getLexVal() const;
+  Value* codegen(driver& drv) { return VariableExprAST::codegen(drv, nullptr); };
+  void resolve(Resolver &R);
+  void infer(TypeInference &T);
+  const Binding &getBinding() const { return B; };
+  static bool classof(const RootAST *N) {
+    return N->getKind() == ASTKind::Variable || N->getKind() == ASTKind::Slicing;
+  };
 };
 
 class SlicingExprAST : public VariableExprAST {
@@ -100,9 +239,13 @@ private:
   ExprAST* IdxExpr;
 
 public:
-  SlicingExprAST(const std::string &Name, ExprAST *IdxExpr) :
-    VariableExprAST(Name), IdxExpr(IdxExpr) {};
-  Value* codegen(driver &drv) override;
+  SlicingExprAST(Ident Name, ExprAST *IdxExpr, SourceLoc Loc) :
+    VariableExprAST(ASTKind::Slicing, Name, Loc), IdxExpr(IdxExpr) {};
+  Value* codegen(driver &drv);
+  void resolve(Resolver &R);
+  void simplify(Simplifier &S);
+  void infer(TypeInference &T);
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::Slicing; };
 };
 
 class BinaryExprAST : public ExprAST {
@@ -110,21 +253,39 @@ private:
   char Op;
   ExprAST* LHS;
   ExprAST* RHS;
+  Value *codegenLogical(driver& drv);  // "and" and "or"
 
 public:
   BinaryExprAST(char Op, ExprAST* LHS, ExprAST* RHS);
-  Value *codegen(driver& drv) override;
+  Value *codegen(driver& drv);
+  void resolve(Resolver &R);
+  ExprAST *simplify(Simplifier &S);
+  void infer(TypeInference &T);
+  char getOp() const { return Op; };
+  ExprAST *getLHS() const { return LHS; };
+  ExprAST *getRHS() const { return RHS; };  // Null for unary operators
+  ValueType operandType() const;  // Type both operands are converted to
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::Binary; };
 };
 
 class CallExprAST : public ExprAST {
 private:
-  std::string Callee;
+  Ident Callee;
   std::vector<ExprAST*> Args;  // Args sub-AST
+  SourceLoc Loc;
+  Binding B;  // Set by the resolver
+  bool Tail = false;  // Its value is returned as is, see markTail
 
 public:
-  CallExprAST(std::string Callee, std::vector<ExprAST*> Args);
-  lexval getLexVal() const override;
-  Value *codegen(driver& drv) override;
+  CallExprAST(Ident Callee, std::vector<ExprAST*> Args, SourceLoc Loc);
+  lexval getLexVal() const;
+  Value *codegen(driver& drv);
+  void markTail(ValueType ret) { Tail = Ty == ret; };
+  bool isTail() const { return Tail; };
+  void resolve(Resolver &R);
+  void simplify(Simplifier &S);
+  void infer(TypeInference &T);
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::Call; };
 };
 
 class IfExprAST : public ExprAST {
@@ -134,7 +295,12 @@ private:
   ExprAST* FalseExp;
 public:
   IfExprAST(ExprAST* Cond, ExprAST* TrueExp, ExprAST* FalseExp);
-  Value *codegen(driver& drv) override;
+  Value *codegen(driver& drv);
+  void markTail(ValueType ret);
+  void resolve(Resolver &R);
+  ExprAST *simplify(Simplifier &S);
+  void infer(TypeInference &T);
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::If; };
 };
 
 class BlockExprAST : public ExprAST {
@@ -143,38 +309,58 @@ private:
   SeqAST* Seq;
 public:
   BlockExprAST(std::vector<VarBindingAST*> Def, SeqAST* Seq);
-  Value *codegen(driver& drv) override;
+  Value *codegen(driver& drv);
+  void markTail(ValueType ret);
+  const SeqAST *getSeq() const { return Seq; };
+  void resolve(Resolver &R);
+  void simplify(Simplifier &S);
+  void infer(TypeInference &T);
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::Block; };
 };
 
-class VarBindingAST: public InitAST {
+class VarBindingAST: public RootAST {
 private:
-  const std::string Name;
+  const Ident Name;
   unsigned Size;  ///< Size == 0 means scalar variable; Size > 0 for arrays
   ExprAST* Val;
   std::vector<ExprAST*> InitializerList;
+  std::optional<ValueType> Declared;  // Annotation, if any
+  unsigned Slot;  // Frame slot, set by the resolver
+  ValueType Ty = ValueType::Double;  // Of the variable or of its elements, set by type inference
 
 public:
-  VarBindingAST(const std::string Name, ExprAST* Val);
-  VarBindingAST(const std::string Name, std::vector<ExprAST*> InitializerList, unsigned Size);
-  AllocaInst *codegen(driver& drv) override;
-  std::string getName() const override;
+  VarBindingAST(Ident Name, ExprAST* Val, std::optional<ValueType> Declared = std::nullopt);
+  VarBindingAST(Ident Name, std::vector<ExprAST*> InitializerList, unsigned Size,
+                std::optional<ValueType> Declared = std::nullopt);
+  AllocaInst *codegen(driver& drv);
+  void resolve(Resolver &R);  // The name is visible only after this
+  void simplify(Simplifier &S);
+  void infer(TypeInference &T);
+  Ident getName() const;
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::VarBinding; };
 };
 
 /// Function prototype.
-/// Made up of name, arguments number and names.
-/// The type is implicitly double.
+/// Made up of name, parameters and type of the result.
+/// Types not annotated are double.
 class PrototypeAST : public RootAST {
 private:
-  std::string Name;
-  std::vector<std::string> Args;
-  bool emitcode;
+  Ident Name;
+  std::vector<Param> Params;
+  ValueType RetType;
+  SourceLoc Loc;
+  unsigned Index;  // In the resolver's function table, set by declare()
 
 public:
-  PrototypeAST(std::string Name, std::vector<std::string> Args);
-  const std::vector<std::string> &getArgs() const;
-  lexval getLexVal() const override;
-  Function *codegen(driver& drv) override;
-  void noemit();
+  PrototypeAST(Ident Name, std::vector<Param> Params, ValueType RetType, SourceLoc Loc);
+  const std::vector<Param> &getParams() const { return Params; };
+  ValueType getRetType() const { return RetType; };
+  Ident getName() const { return Name; };
+  lexval getLexVal() const;
+  Function *codegen(driver& drv);
+  void declare(Resolver &R, bool definition);
+  unsigned getIndex() const { return Index; };
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::Prototype; };
 };
 
 /// Function definition.
@@ -182,48 +368,112 @@ class FunctionAST : public RootAST {
 private:
   PrototypeAST* Proto;
   ExprAST* Body;
-  bool external;
+  unsigned FrameSize;  // Slots for arguments and locals, set by the resolver
   
 public:
   FunctionAST(PrototypeAST* Proto, ExprAST* Body);
-  Function *codegen(driver& drv) override;
+  Function *codegen(driver& drv);
+  void resolve(Resolver &R);
+  void simplify(Simplifier &S);
+  void infer(TypeInference &T);
+  PrototypeAST *getProto() const { return Proto; };
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::Function; };
 };
 
 // Global variable declaration
 class GlobalVarAST : public RootAST {
 private:
-  std::string name;
+  Ident name;
   unsigned size;
+  ValueType type;  // Of the variable or of its elements
+  SourceLoc loc;
+  unsigned index;  // In the resolver's global table, set by declare()
 
 public:
-  GlobalVarAST(const std::string &name) : name(name), size(0) {};
-  GlobalVarAST(const std::string &name, unsigned size) : name(name), size(size) {};
-  GlobalVariable* codegen(driver &drv) override;
-  std::string getName() const { return name; };
+  GlobalVarAST(Ident name, ValueType type, SourceLoc loc) :
+    RootAST(ASTKind::GlobalVar), name(name), size(0), type(type), loc(loc) {};
+  GlobalVarAST(Ident name, unsigned size, ValueType type, SourceLoc loc) :
+    RootAST(ASTKind::GlobalVar), name(name), size(size), type(type), loc(loc) {};
+  GlobalVariable* codegen(driver &drv);
+  void declare(Resolver &R);
+  Ident getName() const { return name; };
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::GlobalVar; };
 };
 
-class AssignmentExprAST : public ExprAST, public InitAST {
+class AssignmentExprAST : public ExprAST {
 private:
-  std::string name;
+  Ident name;
   ExprAST *val, *idxExpr;
+  SourceLoc loc;
+  Binding b;  // Set by the resolver
 
 public:
-  AssignmentExprAST(const std::string &name, ExprAST *val, ExprAST *idxExpr = nullptr) :
-    name(name), val(val), idxExpr(idxExpr) {};
-  Value* codegen(driver &drv) override;
-  std::string getName() const override { return name; };
+  AssignmentExprAST(Ident name, ExprAST *val, ExprAST *idxExpr, SourceLoc loc) :
+    ExprAST(ASTKind::Assignment), name(name), val(val), idxExpr(idxExpr), loc(loc) {};
+  Value* codegen(driver &drv);
+  void resolve(Resolver &R);
+  void simplify(Simplifier &S);
+  void infer(TypeInference &T);
+  Ident getName() const { return name; };
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::Assignment; };
 };
 
 class ForExprAST : public ExprAST {
 private:
-  InitAST *init;
+  RootAST *init;  // Either a VarBindingAST or an AssignmentExprAST
   ExprAST *cond, *body;
   AssignmentExprAST *assignment;
 
 public:
-  ForExprAST(InitAST *init, ExprAST *cond, AssignmentExprAST *assignment, ExprAST *body) :
-    init(init), cond(cond), assignment(assignment), body(body) {};
-  Value* codegen(driver &d) override;
+  ForExprAST(RootAST *init, ExprAST *cond, AssignmentExprAST *assignment, ExprAST *body) :
+    ExprAST(ASTKind::For), init(init), cond(cond), body(body), assignment(assignment) {};
+  Value* codegen(driver &d);
+  void resolve(Resolver &R);
+  void simplify(Simplifier &S);
+  void infer(TypeInference &T);
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::For; };
+};
+
+class WhileExprAST : public ExprAST {
+private:
+  ExprAST *cond, *body;
+
+public:
+  WhileExprAST(ExprAST *cond, ExprAST *body) : ExprAST(ASTKind::While), cond(cond), body(body) {};
+  Value* codegen(driver &drv);
+  void resolve(Resolver &R);
+  ExprAST *simplify(Simplifier &S);
+  void infer(TypeInference &T);
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::While; };
+};
+
+// "break" (kind Break) or "continue" (kind Continue) in the innermost loop
+class JumpExprAST : public ExprAST {
+private:
+  SourceLoc loc;
+
+public:
+  JumpExprAST(ASTKind kind, SourceLoc loc) : ExprAST(kind), loc(loc) {};
+  Value* codegen(driver &drv);
+  void resolve(Resolver &R);
+  void infer(TypeInference &T);
+  static bool classof(const RootAST *N) {
+    return N->getKind() == ASTKind::Break || N->getKind() == ASTKind::Continue;
+  };
+};
+
+class ReturnExprAST : public ExprAST {
+private:
+  ExprAST *val;
+  ValueType retType = ValueType::Double;  // Of the function, set by type inference
+
+public:
+  ReturnExprAST(ExprAST *val) : ExprAST(ASTKind::Return), val(val) {};
+  Value* codegen(driver &drv);
+  void resolve(Resolver &R);
+  void simplify(Simplifier &S);
+  void infer(TypeInference &T);
+  static bool classof(const RootAST *N) { return N->getKind() == ASTKind::Return; };
 };
 
 class UnaryExprAST : public BinaryExprAST {
@@ -234,27 +484,31 @@ public:
 
 class UnaryIncrementAST : public AssignmentExprAST {
 public:
-  UnaryIncrementAST(const std::string &varName) :
+  UnaryIncrementAST(ASTArena &ast, Ident varName, SourceLoc loc) :
     AssignmentExprAST(
       varName,
-      new BinaryExprAST(
+      ast.make<BinaryExprAST>(
         '+',
-        new VariableExprAST(varName),
-        new NumberExprAST(1)
-      )
+        ast.make<VariableExprAST>(varName, loc),
+        ast.make<NumberExprAST>(1)
+      ),
+      nullptr,
+      loc
     ) {};
 };
 
 class UnaryDecrementAST : public AssignmentExprAST {
 public:
-  UnaryDecrementAST(const std::string &varName) :
+  UnaryDecrementAST(ASTArena &ast, Ident varName, SourceLoc loc) :
     AssignmentExprAST(
       varName,
-      new BinaryExprAST(
+      ast.make<BinaryExprAST>(
         '-',
-        new VariableExprAST(varName),
-        new NumberExprAST(1)
-      )
+        ast.make<VariableExprAST>(varName, loc),
+        ast.make<NumberExprAST>(1)
+      ),
+      nullptr,
+      loc
     ) {};
 };
 
@@ -0,0 +1,255 @@
+#include <cmath>
+
+#include "driver.hpp"
+
+// Counters start from literals up to 2^32 and step by literals up to 2^10:
+// they need more than 2^42 steps to get past 2^53
+static const double maxStart = 4294967296.0;
+static const double maxStep = 1024.0;
+
+void TypeInference::run(RootAST *root) {
+  root->infer(*this);
+}
+
+// Whether E is an integral literal within ±limit
+static bool isSmall(const ExprAST *E, double limit) {
+  auto *N = dyn_cast<NumberExprAST>(E);
+  return N && N->getType() == ValueType::Integral && std::fabs(N->getVal()) <= limit;
+}
+
+// Slot of the local scalar read by E, if any
+static std::optional<unsigned> localOf(const ExprAST *E) {
+  if (E->getKind() != ASTKind::Variable)
+    return std::nullopt;
+  auto &B = static_cast<const VariableExprAST*>(E)->getBinding();
+  return B.kind == Binding::Local ? std::optional<unsigned>(B.index) : std::nullopt;
+}
+
+// Slot of the local scalar read by E, possibly plus or minus a step
+static std::optional<unsigned> steppedLocal(const ExprAST *E) {
+  auto *B = dyn_cast<BinaryExprAST>(E);
+  if (not B || not B->getRHS())
+    return localOf(E);
+  if (B->getOp() == '+' && isSmall(B->getLHS(), maxStep))
+    return localOf(B->getRHS());
+  if ((B->getOp() == '+' || B->getOp() == '-') && isSmall(B->getRHS(), maxStep))
+    return localOf(B->getLHS());
+  return std::nullopt;
+}
+
+void TypeInference::store(unsigned slot, const ExprAST *val) {
+  if (frame[slot] != ValueType::Integral || isSmall(val, maxStart))
+    return;
+  auto from = steppedLocal(val);
+  if (from && frame[*from] == ValueType::Integral)
+    return;
+  frame[slot] = ValueType::Double;
+  changed = true;
+}
+
+// Integral doubles from -2^53 to 2^53 are exactly the values of an i64 there;
+// -0 is not one of them
+static bool isIntegral(double value) {
+  return value == std::trunc(value) && std::fabs(value) <= 9007199254740992.0 &&
+    not (value == 0 && std::signbit(value));
+}
+
+// Numeric types mix as in C, double being the widest; an int and an integer
+// double mix into a double, as an int may be past 2^53
+static ValueType join(ValueType a, ValueType b) {
+  if (a == b) return a;
+  if (a == ValueType::Double || b == ValueType::Double) return ValueType::Double;
+  if (a == ValueType::Float || b == ValueType::Float) return ValueType::Float;
+  return ValueType::Double;
+}
+
+// Type of E as an operand next to one of type other: literals take the type
+// of an f32 operand, and integral ones of an int operand, as they would if
+// stored into a variable of that type. A folded constant stands for a double
+// expression: it keeps its precision next to f32, and goes into int only when
+// small enough to be exact.
+static ValueType operandOf(const ExprAST *E, ValueType other) {
+  ValueType t = E->getType();
+  auto *N = dyn_cast<NumberExprAST>(E);
+  if (not N)
+    return t;
+  if (other == ValueType::Float && not N->isFolded())
+    return other;
+  if (other == ValueType::Int && isInteger(t) && (not N->isFolded() || isSmall(E, maxStart)))
+    return other;
+  return t;
+}
+
+
+// Non-virtual dispatch, as for codegen
+void RootAST::infer(TypeInference &T) {
+  switch (Kind) {
+  case ASTKind::Seq:        return static_cast<SeqAST*>(this)->infer(T);
+  case ASTKind::Number:     return static_cast<NumberExprAST*>(this)->infer(T);
+  case ASTKind::Variable:   return static_cast<VariableExprAST*>(this)->infer(T);
+  case ASTKind::Slicing:    return static_cast<SlicingExprAST*>(this)->infer(T);
+  case ASTKind::Binary:     return static_cast<BinaryExprAST*>(this)->infer(T);
+  case ASTKind::Call:       return static_cast<CallExprAST*>(this)->infer(T);
+  case ASTKind::If:         return static_cast<IfExprAST*>(this)->infer(T);
+  case ASTKind::Block:      return static_cast<BlockExprAST*>(this)->infer(T);
+  case ASTKind::VarBinding: return static_cast<VarBindingAST*>(this)->infer(T);
+  case ASTKind::Function:   return static_cast<FunctionAST*>(this)->infer(T);
+  case ASTKind::Assignment: return static_cast<AssignmentExprAST*>(this)->infer(T);
+  case ASTKind::For:        return static_cast<ForExprAST*>(this)->infer(T);
+  case ASTKind::While:      return static_cast<WhileExprAST*>(this)->infer(T);
+  case ASTKind::Break:
+  case ASTKind::Continue:   return static_cast<JumpExprAST*>(this)->infer(T);
+  case ASTKind::Return:     return static_cast<ReturnExprAST*>(this)->infer(T);
+  case ASTKind::Prototype:
+  case ASTKind::GlobalVar:
+    return;
+  }
+};
+
+void SeqAST::infer(TypeInference &T) {
+  for (auto elem : elems)
+    elem->infer(T);
+}
+
+void NumberExprAST::infer(TypeInference &T) {
+  Ty = isIntegral(Val) ? ValueType::Integral : ValueType::Double;
+}
+
+// Of the variable, or of its elements
+void VariableExprAST::infer(TypeInference &T) {
+  Ty = B.isFrameSlot() ? T.frame[B.index] : T.R.globals[B.index].type;
+}
+
+void SlicingExprAST::infer(TypeInference &T) {
+  IdxExpr->infer(T);
+  VariableExprAST::infer(T);
+}
+
+ValueType BinaryExprAST::operandType() const {
+  ValueType l = LHS->getType();
+  if (l == ValueType::Bool)
+    return l;
+  if (not RHS)  // Negation
+    return l == ValueType::Integral ? ValueType::Double : l;
+  ValueType lo = operandOf(LHS, RHS->getType()), ro = operandOf(RHS, l);
+  if ((Op == '<' || Op == '>' || Op == '=') && isInteger(lo) && isInteger(ro))  // Exact, counters being far from 2^53
+    return ValueType::Int;
+  ValueType t = join(lo, ro);
+  if (Op == '/' && isInteger(t))  // Division is never truncated
+    return ValueType::Double;
+  // Products may be -0, and literals too large for counters could take sums past 2^53
+  auto isLarge = [](const ExprAST *E) { return isa<NumberExprAST>(E) && not isSmall(E, maxStart); };
+  if (t == ValueType::Integral && (Op == '*' || isLarge(LHS) || isLarge(RHS)))
+    return ValueType::Double;
+  return t;
+}
+
+void BinaryExprAST::infer(TypeInference &T) {
+  LHS->infer(T);
+  if (RHS) RHS->infer(T);
+  if (Op == '<' || Op == '>' || Op == '=')
+    for (auto operand : {LHS, RHS})
+      if (auto slot = steppedLocal(operand))
+        T.compared[*slot] = true;
+  switch (Op) {
+  case '+':
+  case '-':
+  case '*':
+  case '/':
+    Ty = operandType();
+    break;
+  default:  // Comparisons and logical operators
+    Ty = ValueType::Bool;
+  }
+}
+
+void CallExprAST::infer(TypeInference &T) {
+  for (auto arg : Args)
+    arg->infer(T);
+  Ty = T.R.functions[B.index].ret;
+}
+
+void IfExprAST::infer(TypeInference &T) {
+  Cond->infer(T);
+  TrueExp->infer(T);
+  if (FalseExp) FalseExp->infer(T);
+  // Without an else the value is undefined, and a double
+  if (FalseExp)
+    Ty = join(operandOf(TrueExp, FalseExp->getType()), operandOf(FalseExp, TrueExp->getType()));
+  else
+    Ty = ValueType::Double;
+}
+
+void BlockExprAST::infer(TypeInference &T) {
+  for (auto def : Def)
+    def->infer(T);
+  Seq->infer(T);
+  auto &elems = Seq->getElems();
+  auto *last = elems.empty() ? nullptr : dyn_cast<ExprAST>(elems.back());
+  Ty = last ? last->getType() : ValueType::Double;
+}
+
+void VarBindingAST::infer(TypeInference &T) {
+  for (auto init : InitializerList)
+    init->infer(T);
+  if (Val) Val->infer(T);
+  if (Declared || Size)
+    T.frame[Slot] = Declared.value_or(ValueType::Double);
+  else if (Val)  // Otherwise it starts from 0, a counter
+    T.store(Slot, Val);
+  Ty = T.frame[Slot];
+}
+
+void FunctionAST::infer(TypeInference &T) {
+  // Optimistically, every local is a counter: walks of the body take that back
+  // from the ones something else is stored into, or never compared, until no
+  // more change
+  T.frame.assign(FrameSize, ValueType::Integral);
+  T.compared.assign(FrameSize, false);
+  T.ret = Proto->getRetType();
+  auto &params = Proto->getParams();
+  for (unsigned i = 0; i < params.size(); i++)
+    T.frame[i] = params[i].type;
+  do {
+    T.changed = false;
+    Body->infer(T);
+    for (unsigned i = params.size(); i < FrameSize; i++)
+      if (T.frame[i] == ValueType::Integral && not T.compared[i]) {
+        T.frame[i] = ValueType::Double;
+        T.changed = true;
+      }
+  } while (T.changed);
+}
+
+void AssignmentExprAST::infer(TypeInference &T) {
+  val->infer(T);
+  if (idxExpr) idxExpr->infer(T);
+  if (b.kind == Binding::Local && not idxExpr)
+    T.store(b.index, val);
+  // Of the variable, or of its elements
+  Ty = b.isFrameSlot() ? T.frame[b.index] : T.R.globals[b.index].type;
+}
+
+void ForExprAST::infer(TypeInference &T) {
+  init->infer(T);
+  cond->infer(T);
+  body->infer(T);
+  assignment->infer(T);
+  Ty = ValueType::Double;  // Undefined
+}
+
+void WhileExprAST::infer(TypeInference &T) {
+  cond->infer(T);
+  body->infer(T);
+  Ty = ValueType::Double;  // Undefined
+}
+
+void JumpExprAST::infer(TypeInference &T) {
+  Ty = ValueType::Double;  // Never used: nothing after the jump is reached
+}
+
+void ReturnExprAST::infer(TypeInference &T) {
+  val->infer(T);
+  retType = T.ret;
+  Ty = ValueType::Double;  // As for jumps
+}
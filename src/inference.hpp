@@ -0,0 +1,38 @@
+#ifndef INFERENCE_HPP
+#define INFERENCE_HPP
+
+#include <vector>
+
+#include "types.hpp"
+
+class RootAST;
+class ExprAST;
+class Resolver;
+
+// Type inference, run on each AST after simplification. Annotated variables,
+// parameters and globals have the type they are declared with, the others
+// are doubles; but a local scalar without annotation is kept as an integer
+// (Integral, i64 in IR) when it is a counter: it appears in a comparison,
+// and every value stored into it is a small integral literal, or a counter
+// plus or minus a small integral literal. Anything else, as in x = x + y,
+// makes it a double. Counters move by small steps from a small start: they
+// would need trillions of steps to leave ±2^53, where integer and double
+// arithmetic agree. Their sums, differences and comparisons are computed
+// in integer arithmetic and need no conversion as array subscripts; their
+// products and negations stay double, as they may give a negative zero,
+// which integers cannot hold.
+class TypeInference {
+public:
+  TypeInference(const Resolver &R) : R(R) {};
+  void run(RootAST *root);
+
+  // Used by the infer() methods of the AST
+  const Resolver &R;  // Types of globals and functions
+  std::vector<ValueType> frame;  // Of each slot of the function, of the elements for arrays
+  ValueType ret;  // Of the function
+  std::vector<bool> compared;  // Slots appearing in a comparison
+  bool changed;  // A slot lost its integer type during the current walk
+  void store(unsigned slot, const ExprAST *val);  // Stores val into a local slot
+};
+
+#endif // ! INFERENCE_HPP
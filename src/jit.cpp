@@ -0,0 +1,81 @@
+#include "jit.hpp"
+
+#include <ctime>
+#include <iostream>
+
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm::orc;
+
+// Built-in runtime: same semantics as the helpers in test/time_and_print.cpp
+static double timek() {
+  return std::time(nullptr);
+}
+
+static double printval(double x, double controlchar) {
+  if (controlchar == 0) std::cout << x << std::endl;
+  else std::cout << "--------------------\n---Array ordinato---\n--------------------\n";
+  return 0;
+}
+
+static int logJITError(Error err) {
+  errs() << "JIT error: " << toString(std::move(err)) << "\n";
+  return 1;
+}
+
+int runModule(std::unique_ptr<Module> module, std::unique_ptr<LLVMContext> context, const std::string &entry) {
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+
+  auto maybeJIT = LLJITBuilder().create();
+  if (not maybeJIT) return logJITError(maybeJIT.takeError());
+  auto &jit = **maybeJIT;
+  const DataLayout &dl = jit.getDataLayout();
+
+  // Runtime symbols live in their own dylib, so that Kaleidoscope definitions
+  // in the main one take precedence over both built-ins and process symbols
+  auto &runtime = jit.getExecutionSession().createBareJITDylib("<runtime>");
+  MangleAndInterner mangle(jit.getExecutionSession(), dl);
+  SymbolMap builtins;
+  builtins[mangle("timek")] = JITEvaluatedSymbol(pointerToJITTargetAddress(&timek), JITSymbolFlags::Exported);
+  builtins[mangle("printval")] = JITEvaluatedSymbol(pointerToJITTargetAddress(&printval), JITSymbolFlags::Exported);
+  if (auto err = runtime.define(absoluteSymbols(std::move(builtins))))
+    return logJITError(std::move(err));
+
+  auto processSymbols = DynamicLibrarySearchGenerator::GetForCurrentProcess(dl.getGlobalPrefix());
+  if (not processSymbols) return logJITError(processSymbols.takeError());
+  runtime.addGenerator(std::move(*processSymbols));
+  jit.getMainJITDylib().addToLinkOrder(runtime);
+
+  Function *entryFun = module->getFunction(entry);
+  if (not entryFun or entryFun->isDeclaration()) {
+    errs() << "Entry point " << entry << " is not defined\n";
+    return 1;
+  }
+  if (entryFun->arg_size() != 0) {
+    errs() << "Entry point " << entry << " must not take arguments\n";
+    return 1;
+  }
+
+  // The result is dropped, but how it is returned depends on its type; the
+  // module is given away to the JIT before the call
+  bool returnsFloat = entryFun->getReturnType()->isFloatTy();
+  bool returnsInt = entryFun->getReturnType()->isIntegerTy();
+
+  module->setDataLayout(dl);
+  if (auto err = jit.addIRModule(ThreadSafeModule(std::move(module), std::move(context))))
+    return logJITError(std::move(err));
+
+  auto entryAddr = jit.lookup(entry);
+  if (not entryAddr) return logJITError(entryAddr.takeError());
+
+  if (returnsFloat) entryAddr->toPtr<float()>()();
+  else if (returnsInt) entryAddr->toPtr<int64_t()>()();
+  else entryAddr->toPtr<double()>()();
+  return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <memory>
+#include <string>
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+using namespace llvm;
+
+// JIT-compiles the module with ORC LLJIT and calls its zero-arguments entry point.
+// Undefined symbols are looked up in the built-in runtime (timek, printval)
+// and then in the kcomp process itself (e.g. libm's sqrt and floor).
+// Returns the process exit code: 0 on success.
+int runModule(std::unique_ptr<Module> module, std::unique_ptr<LLVMContext> context, const std::string &entry);
+
+#endif // ! JIT_HPP
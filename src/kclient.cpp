@@ -0,0 +1,12 @@
+#include <iostream>
+#include "server.hpp"
+
+// kclient <socket> <kcomp arguments>: same as kcomp --connect, but a process that
+// starts without loading LLVM, for build systems that run the compiler many times
+int main (int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cerr << "usage: kclient <socket> <kcomp arguments>" << std::endl;
+    return 1;
+  }
+  return runClient(argv[1], std::vector<std::string>(argv + 2, argv + argc));
+}
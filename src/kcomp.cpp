@@ -1,24 +1,686 @@
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include "driver.hpp"
+#include "backend.hpp"
+#include "cache.hpp"
+#include "jit.hpp"
+#include "server.hpp"
 
-extern LLVMContext *context;
-extern Module *module;
-extern IRBuilder<> *builder;
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_os_ostream.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 
-int main (int argc, char *argv[]) {
+// What kcomp writes out once the module is ready
+enum class OutputKind { IR, Assembly, Object };
+
+struct Options {
+  bool trace_parsing = false;
+  bool trace_scanning = false;
+  bool flex = false;  // Scan with the flex scanner instead of the hand-written lexer
+  bool pratt = false;  // Parse with the hand-written parser instead of the Bison one
+  bool fastMath = false;  // Simplify the AST with rewrites that are not exact in IEEE arithmetic
+  unsigned optLevel = 0;
+  OutputKind outputKind = OutputKind::IR;
+  bool emitLLVM = false;  // With -c/-S: bitcode/textual IR instead of native code
+  std::string outputFile;  // Empty means IR on stderr
+  bool run = false;  // JIT-compile and execute instead of writing output
+  std::string entry = "main";
+  unsigned jobs = 0;  // 0: all inputs in one module; N: one module per input on N threads
+  unsigned parseJobs = 1;  // Threads parsing each large input, in one module
+  unsigned codegenJobs = 1;  // Threads generating and optimizing the functions of one module
+  unsigned backendJobs = 1;  // With -c/-S: partitions of the module lowered on as many threads
+  std::string cacheDir;  // Cache of optimized definitions; empty for none
+  bool time = false;  // Report time spent in each phase
+  bool stream = false;  // Generate and write out each top-level definition as soon as it is parsed
+  bool parseOnly = false;  // Stop once the inputs are parsed
+  std::string server;  // Socket of --server
+  std::string outputDir;  // Where -j writes its outputs; empty for the working directory
+  std::vector<std::string> files;
+};
+
+// What a compilation writes on stdout and stderr: the process's own streams, or
+// buffers sent back to a client by the server. IR, traces and the errors of
+// LLVM itself share the stream of errors.
+struct Console {
+  std::ostream &out;  // Diagnostics and --time
+  std::ostream &err;
+  raw_ostream &ir;
+  raw_ostream &llvmErr;  // Verifier, target, emission and linker errors
+};
+
+// LLVM reports some errors, the linker's among them, through the context:
+// printed to diag, they do not end the process as they would by default
+static void printDiagnostic(const DiagnosticInfo &info, void *diag) {
+  auto &out = *static_cast<raw_ostream*>(diag);
+  DiagnosticPrinterRawOStream printer(out);
+  out << LLVMContext::getDiagnosticMessagePrefix(info.getSeverity()) << ": ";
+  info.print(printer);
+  out << "\n";
+}
+
+static void reportTo(LLVMContext &context, raw_ostream &diag) {
+  context.setDiagnosticHandlerCallBack(printDiagnostic, &diag, true);
+}
+
+// Wall-clock time spent in each compilation phase, reported by --time
+class PhaseTimer {
+private:
+  using clock = std::chrono::steady_clock;
+  clock::time_point last = clock::now();
+  std::vector<std::pair<std::string, double>> phases;  // In first-seen order
+
+public:
+  // Charges the time elapsed since the previous lap to phase
+  void lap(const std::string &phase) {
+    auto now = clock::now();
+    double ms = std::chrono::duration<double, std::milli>(now - last).count();
+    last = now;
+    for (auto &p : phases)
+      if (p.first == phase) { p.second += ms; return; }
+    phases.emplace_back(phase, ms);
+  }
+
+  void print(std::ostream &out) const {
+    double total = 0;
+    for (auto &p : phases) {
+      out << std::left << std::setw(10) << p.first << std::fixed << std::setprecision(2) << p.second << " ms\n";
+      total += p.second;
+    }
+    out << std::left << std::setw(10) << "total" << total << " ms" << std::endl;
+  }
+};
+
+// Output file of an input compiled on its own: foo.k -> foo.{o,s,bc,ll}
+static std::string outputFileFor(const std::string &input, const Options &opts) {
+  SmallString<128> path(opts.outputDir);
+  sys::path::append(path, sys::path::filename(input));
+  const char *ext = opts.outputKind == OutputKind::Object ? (opts.emitLLVM ? "bc" : "o") : (opts.emitLLVM ? "ll" : "s");
+  sys::path::replace_extension(path, ext);
+  return path.str().str();
+}
+
+// Writes the module in the requested form to out
+static bool writeModule(Module &module, TargetMachine &tm, const Options &opts, raw_pwrite_stream &out,
+                        raw_ostream &diag) {
+  if (opts.outputKind == OutputKind::IR || (opts.emitLLVM && opts.outputKind == OutputKind::Assembly))
+    module.print(out, nullptr);
+  else if (opts.emitLLVM)
+    WriteBitcodeToFile(module, out);
+  else
+    return emitModule(module, tm, out, opts.outputKind == OutputKind::Object ? CGFT_ObjectFile : CGFT_AssemblyFile,
+                      diag);
+  return true;
+}
+
+static bool writeModule(Module &module, TargetMachine &tm, const Options &opts, const std::string &outputFile,
+                        raw_ostream &diag) {
+  std::error_code ec;
+  bool binary = opts.outputKind == OutputKind::Object;
+  raw_fd_ostream out(outputFile, ec, binary ? sys::fs::OF_None : sys::fs::OF_Text);
+  if (ec) {
+    diag << "cannot open " << outputFile << ": " << ec.message() << "\n";
+    return false;
+  }
+  return writeModule(module, tm, opts, out, diag);
+}
+
+// Partition i of the output file of --backend-jobs: foo.o -> foo.<i>.o
+static std::string partitionFile(const std::string &outputFile, unsigned i) {
+  SmallString<128> path(outputFile);
+  std::string ext = sys::path::extension(outputFile).str();
+  sys::path::replace_extension(path, "." + std::to_string(i) + ext);
+  return path.str().str();
+}
+
+// Native code of the module, split into opts.backendJobs outputs lowered in parallel
+static bool writeModuleSplit(Module &module, const Options &opts, const std::string &outputFile, raw_ostream &diag) {
+  std::vector<std::unique_ptr<raw_fd_ostream>> files;
+  std::vector<raw_pwrite_stream*> outs;
+  bool binary = opts.outputKind == OutputKind::Object;
+  for (unsigned i = 0; i < opts.backendJobs; i++) {
+    std::string name = partitionFile(outputFile, i);
+    std::error_code ec;
+    files.push_back(std::make_unique<raw_fd_ostream>(name, ec, binary ? sys::fs::OF_None : sys::fs::OF_Text));
+    if (ec) {
+      diag << "cannot open " << name << ": " << ec.message() << "\n";
+      return false;
+    }
+    outs.push_back(files.back().get());
+  }
+  return emitModuleSplit(module, opts.optLevel, outs, binary ? CGFT_ObjectFile : CGFT_AssemblyFile, diag);
+}
+
+// Generates the functions of drv's AST on a pool of opts.codegenJobs threads.
+// Externs and globals are generated in drv's unit; the definitions are split in
+// contiguous batches, each generated into a context and module of its own and
+// optimized there. Batches rather than one module per function, as a context
+// costs more than a small function. The batches are then linked, in order, into
+// drv's module through bitcode, as modules of different contexts cannot be
+// linked directly. Diagnostics are printed in source order.
+// With a cache, each definition of a batch gets a module of its own in the
+// batch's context: it is optimized only if the cache does not know it yet.
+static bool codegenParallel(driver &drv, const Options &opts, Console &con, DefinitionCache *cache) {
+  if (not drv.resolve()) return false;
+
+  std::vector<FunctionAST*> functions;
+  bool ok = true;
+  for (auto *top : cast<SeqAST>(drv.root)->getElems()) {
+    if (auto *F = dyn_cast<FunctionAST>(top))
+      functions.push_back(F);
+    else
+      ok = drv.lower(top) && ok;
+  }
+
+  struct Batch {
+    size_t begin, end;
+    std::ostringstream diag;
+    std::string llvmDiag;
+    std::vector<SmallVector<char, 0>> bitcode;  // Modules to link, in order
+    unsigned errors = 0;
+  };
+  size_t count = std::min<size_t>(functions.size(), opts.codegenJobs * 4);
+  std::vector<Batch> batches(count);
+  for (size_t i = 0; i < count; i++) {
+    batches[i].begin = functions.size() * i / count;
+    batches[i].end = functions.size() * (i + 1) / count;
+  }
+
+  ThreadPool pool(hardware_concurrency(opts.codegenJobs));
+  for (auto &batch : batches) {
+    pool.async([&] {
+      driver worker;
+      worker.diag = &batch.diag;
+      worker.shareResolution(drv);
+      raw_string_ostream llvmDiag(batch.llvmDiag);
+      reportTo(*worker.unit.context, llvmDiag);
+      auto tm = createHostTargetMachine(opts.optLevel, llvmDiag);
+      if (not tm) {  // Said why on llvmDiag
+        batch.errors++;
+        return;
+      }
+      auto &module = *worker.unit.module;
+      module.setTargetTriple(tm->getTargetTriple().str());
+      module.setDataLayout(tm->createDataLayout());
+
+      if (not cache) {
+        for (size_t i = batch.begin; i < batch.end; i++)
+          worker.lower(functions[i]);
+        batch.errors = worker.errors;
+        if (batch.errors || not optimizeModule(module, *tm, opts.optLevel, llvmDiag)) {
+          batch.errors++;
+          return;
+        }
+        raw_svector_ostream out(batch.bitcode.emplace_back());
+        WriteBitcodeToFile(module, out);
+        return;
+      }
+
+      for (size_t i = batch.begin; i < batch.end; i++) {
+        worker.unit.startModule("definition");  // The name is part of the key
+        if (not worker.lower(functions[i])) continue;
+        auto &definition = *worker.unit.module;
+        std::string key = cache->keyOf(definition);
+        auto &bitcode = batch.bitcode.emplace_back();
+        if (cache->load(key, *worker.unit.context, bitcode)) continue;
+        if (not optimizeModule(definition, *tm, opts.optLevel, llvmDiag)) {
+          batch.errors++;
+          break;
+        }
+        raw_svector_ostream out(bitcode);
+        WriteBitcodeToFile(definition, out);
+        cache->store(key, StringRef(bitcode.data(), bitcode.size()));
+      }
+      batch.errors += worker.errors;
+    });
+  }
+  pool.wait();
+
+  for (auto &batch : batches) {
+    con.out << batch.diag.str();
+    con.llvmErr << batch.llvmDiag;
+    drv.errors += batch.errors;
+    if (batch.errors) {
+      ok = false;
+      continue;
+    }
+    for (auto &bitcode : batch.bitcode) {
+      auto module = parseBitcodeFile(MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), "batch"), *drv.unit.context);
+      if (not module) {
+        con.err << toString(module.takeError()) << std::endl;
+        return false;
+      }
+      if (Linker::linkModules(*drv.unit.module, std::move(*module)))
+        return false;
+    }
+  }
+  drv.rebindUnit();
+  return ok;
+}
+
+// The cache of --cache, if any, keyed also by the flags that shape the optimized
+// code. False, after saying why on con.err, if its directory cannot be created.
+static bool openCache(const Options &opts, TargetMachine &tm, Console &con, std::unique_ptr<DefinitionCache> &cache) {
+  if (opts.cacheDir.empty()) return true;
+  std::string flags = "-O" + std::to_string(opts.optLevel) + " " + tm.getTargetCPU().str() + " " + tm.getTargetFeatureString().str();
+  cache = std::make_unique<DefinitionCache>(opts.cacheDir, flags);
+  std::string error;
+  if (not cache->open(error)) {
+    con.err << error << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// All inputs are lowered into one module, which is then optimized and written out or run
+static int compileTogether(const Options &opts, Console &con) {
   int res = 0;
   driver drv;
-  int i = 1;
-  while (i<argc) {
-    if (argv[i] == std::string ("-p"))
-      drv.trace_parsing = true; // Abilita tracce debug nel parser
-    else if (argv[i] == std::string ("-s"))
-      drv.trace_scanning = true;// Abilita tracce debug nello scanner
-    else  if (!drv.parse(argv[i])) { // Parsing e creazione dell'AST
-      drv.codegen();                 // Visita AST e generazione dell'IR (su stderr)
-    } else
+  drv.diag = &con.out;
+  drv.trace = &con.err;
+  reportTo(*drv.unit.context, con.llvmErr);
+  drv.trace_parsing = opts.trace_parsing;
+  drv.trace_scanning = opts.trace_scanning;
+  drv.use_flex = opts.flex;
+  drv.use_pratt = opts.pratt;
+  drv.fast_math = opts.fastMath;
+  drv.parseJobs = opts.parseJobs;
+
+  std::string outputFile = opts.outputFile;
+  // Native outputs default to <input>.o / <input>.s, as a C compiler would
+  if (not opts.run && opts.outputKind != OutputKind::IR && outputFile.empty()) {
+    if (opts.files.size() != 1) {
+      con.err << "-o is required when compiling several inputs with -c or -S" << std::endl;
+      return 1;
+    }
+    outputFile = outputFileFor(opts.files[0], opts);
+  }
+
+  PhaseTimer timer;
+  auto tm = createHostTargetMachine(opts.optLevel, con.llvmErr);
+  if (not tm) return 1;
+  auto &module = drv.unit.module;
+  module->setTargetTriple(tm->getTargetTriple().str());
+  module->setDataLayout(tm->createDataLayout());
+
+  // Definitions are optimized on their own, and not again once linked, with
+  // --codegen-jobs or a cache
+  std::unique_ptr<DefinitionCache> cache;
+  if (not openCache(opts, *tm, con, cache)) return 1;
+  bool perDefinition = opts.codegenJobs > 1 || cache;
+  timer.lap("setup");
+
+  size_t astNodes = 0, astBytes = 0;
+  for (const auto &f : opts.files) {
+    if (drv.parse(f))  // Parsing e creazione dell'AST
       res = 1;
-    i++;
+    timer.lap("parse");
+    astNodes += drv.ast.getNodeCount();
+    astBytes += drv.ast.getBytesAllocated();
+    if (opts.parseOnly) continue;
+    if (!res && !(perDefinition ? codegenParallel(drv, opts, con, cache.get()) : drv.codegen()))  // Visita AST e generazione dell'IR
+      res = 1;
+    timer.lap("codegen");
+  }
+  if (res) return res;  // No output for a failed compilation
+
+  auto report = [&] {
+    if (not opts.time) return;
+    con.out << "ast       " << astNodes << " nodes, " << astBytes << " bytes\n";
+    if (cache)
+      con.out << "cache     " << cache->hits << " hits, " << cache->misses << " misses\n";
+    timer.print(con.out);
+  };
+  if (opts.parseOnly) {
+    report();
+    return 0;
+  }
+
+  // The whole module is optimized before any output is written. With
+  // --codegen-jobs or a cache each definition already was: only verify the link
+  if (not optimizeModule(*module, *tm, perDefinition ? 0 : opts.optLevel, con.llvmErr)) return 1;
+  timer.lap("optimize");
+
+  if (opts.run) {  // The JIT takes ownership of the module and its context
+    report();
+    return runModule(std::move(drv.unit.module), std::move(drv.unit.context), opts.entry);
+  }
+
+  bool written = true;
+  if (opts.outputKind == OutputKind::IR && outputFile.empty())
+    module->print(con.ir, nullptr);  // IR su stderr
+  else if (opts.backendJobs > 1 && not opts.emitLLVM && opts.outputKind != OutputKind::IR) {
+    written = writeModuleSplit(*module, opts, outputFile, con.llvmErr);
+    // outputFile itself is not written: an old one must not pass for the
+    // result, and the build is told where the code went instead
+    sys::fs::remove(outputFile);
+    if (written) {
+      con.out << outputFile << " is split into";
+      for (unsigned i = 0; i < opts.backendJobs; i++)
+        con.out << ' ' << partitionFile(outputFile, i);
+      con.out << std::endl;
+    }
+  }
+  else
+    written = writeModule(*module, *tm, opts, outputFile, con.llvmErr);
+  timer.lap("emit");
+  report();
+  return written ? 0 : 1;
+}
+
+// Each top-level definition is generated, optimized and written out as textual IR
+// as soon as it is parsed; then its AST and its body are released. Memory stays
+// proportional to the largest function instead of the whole input.
+static int compileStreaming(const Options &opts, Console &con) {
+  if (opts.run || opts.jobs || opts.outputKind != OutputKind::IR) {
+    con.err << "--stream writes textual IR only: -c, -S, -j and --run are not supported" << std::endl;
+    return 1;
+  }
+  if (opts.parseJobs > 1 || opts.codegenJobs > 1 || not opts.cacheDir.empty()) {
+    con.err << "--stream optimizes each function as soon as it is parsed: --parse-jobs, --codegen-jobs and --cache are not supported" << std::endl;
+    return 1;
+  }
+
+  driver drv;
+  drv.trace_parsing = opts.trace_parsing;
+  drv.trace_scanning = opts.trace_scanning;
+  drv.use_flex = opts.flex;
+  drv.use_pratt = opts.pratt;
+  drv.fast_math = opts.fastMath;
+  drv.diag = &con.out;
+  drv.trace = &con.err;
+  reportTo(*drv.unit.context, con.llvmErr);
+
+  PhaseTimer timer;
+  auto tm = createHostTargetMachine(opts.optLevel, con.llvmErr);
+  if (not tm) return 1;
+  auto &module = drv.unit.module;
+  module->setTargetTriple(tm->getTargetTriple().str());
+  module->setDataLayout(tm->createDataLayout());
+
+  std::unique_ptr<raw_fd_ostream> file;
+  raw_ostream *out = &con.ir;  // IR su stderr
+  if (not opts.outputFile.empty()) {
+    std::error_code ec;
+    file = std::make_unique<raw_fd_ostream>(opts.outputFile, ec, sys::fs::OF_Text);
+    if (ec) {
+      con.err << "cannot open " << opts.outputFile << ": " << ec.message() << std::endl;
+      return 1;
+    }
+    out = file.get();
+  }
+  else
+    con.ir.SetBuffered();  // Unbuffered by default: one write per token otherwise
+
+  // Top-level entities may come in any order in textual IR: the header goes
+  // first, definitions as they are generated, remaining declarations last
+  *out << "; ModuleID = '" << module->getModuleIdentifier() << "'\n"
+       << "target datalayout = \"" << module->getDataLayoutStr() << "\"\n"
+       << "target triple = \"" << module->getTargetTriple() << "\"\n\n";
+  timer.lap("setup");
+
+  FunctionOptimizer optimizer(*tm, opts.optLevel, con.llvmErr);
+  // Printing a function walks every global of its module: functions are printed
+  // from a module of their own, then put back as bare declarations
+  Module scratch("stream", *drv.unit.context);
+  SmallPtrSet<Function*, 32> written;
+  bool failed = false;
+  drv.stream = [&](GlobalValue *GV) {
+    auto *F = dyn_cast<Function>(GV);
+    if (not F) {  // Globals are few: printed in place
+      GV->print(*out);
+      *out << "\n";
+      return;
+    }
+    if (F->isDeclaration()) return;  // An extern: it may still be defined later
+    if (not optimizer.run(*F)) {
+      failed = true;
+      return;
+    }
+    F->removeFromParent();
+    scratch.getFunctionList().push_back(F);
+    F->print(*out);
+    *out << "\n";
+    F->deleteBody();  // Later calls only need the declaration
+    F->removeFromParent();
+    module->getFunctionList().push_back(F);
+    written.insert(F);
+  };
+
+  for (const auto &f : opts.files)
+    if (drv.parse(f))
+      failed = true;
+  failed = failed || drv.errors;
+  timer.lap("stream");
+
+  // Externs never defined, and intrinsics the optimizer introduced
+  if (not failed)
+    for (auto &F : *module)
+      if (not written.count(&F)) {
+        if (F.isIntrinsic())  // Their attributes are implied, no attribute group is printed
+          F.setAttributes({});
+        F.print(*out);
+      }
+  out->flush();
+  timer.lap("emit");
+
+  if (failed && file) {  // No output for a failed compilation
+    file.reset();
+    sys::fs::remove(opts.outputFile);
+  }
+  if (opts.time) {
+    con.out << "ast       " << drv.ast.getPeakBytes() << " bytes at peak\n";
+    timer.print(con.out);
+  }
+  return failed ? 1 : 0;
+}
+
+// Each input is compiled into its own context and module on a pool of opts.jobs threads.
+// Diagnostics, traces, errors and IR on stderr are buffered per input and printed in input order.
+// --parse-jobs and --codegen-jobs apply to each input; with them or a cache, shared by all
+// inputs, definitions are optimized one at a time as by compileTogether.
+static int compileSeparately(const Options &opts, Console &con) {
+  if (opts.run || not opts.outputFile.empty() || opts.backendJobs > 1 || opts.time) {
+    con.err << "-j compiles every input on its own: --run, -o, --backend-jobs and --time are not supported" << std::endl;
+    return 1;
+  }
+
+  struct Job {
+    std::ostringstream diag, trace;
+    std::string llvmDiag;
+    std::string ir;
+    bool failed = false;
+  };
+  std::vector<Job> jobs(opts.files.size());
+
+  // Make sure targets are registered before workers start
+  auto hostTM = createHostTargetMachine(opts.optLevel, con.llvmErr);
+  if (not hostTM) return 1;
+  std::unique_ptr<DefinitionCache> cache;
+  if (not openCache(opts, *hostTM, con, cache)) return 1;
+
+  ThreadPool pool(hardware_concurrency(opts.jobs));
+  for (size_t i = 0; i < opts.files.size(); i++) {
+    pool.async([&, i] {
+      Job &job = jobs[i];
+      const std::string &file = opts.files[i];
+      driver drv;
+      drv.trace_parsing = opts.trace_parsing;
+      drv.trace_scanning = opts.trace_scanning;
+      drv.use_flex = opts.flex;
+      drv.use_pratt = opts.pratt;
+      drv.fast_math = opts.fastMath;
+      drv.parseJobs = opts.parseJobs;
+      drv.diag = &job.diag;
+      raw_string_ostream llvmDiag(job.llvmDiag);
+      drv.trace = &job.trace;
+      reportTo(*drv.unit.context, llvmDiag);
+
+      auto tm = createHostTargetMachine(opts.optLevel, llvmDiag);
+      if (not tm) {  // Said why on llvmDiag
+        job.failed = true;
+        return;
+      }
+      auto &module = drv.unit.module;
+      module->setTargetTriple(tm->getTargetTriple().str());
+      module->setDataLayout(tm->createDataLayout());
+
+      Console jobCon{job.diag, job.trace, llvmDiag, llvmDiag};
+      bool perDefinition = opts.codegenJobs > 1 || cache;
+      if (drv.parse(file) || !(perDefinition ? codegenParallel(drv, opts, jobCon, cache.get()) : drv.codegen()) ||
+          !optimizeModule(*module, *tm, perDefinition ? 0 : opts.optLevel, llvmDiag)) {
+        job.failed = true;
+        return;
+      }
+
+      if (opts.outputKind == OutputKind::IR) {
+        raw_string_ostream out(job.ir);
+        module->print(out, nullptr);
+      }
+      else
+        job.failed = not writeModule(*module, *tm, opts, outputFileFor(file, opts), llvmDiag);
+    });
+  }
+  pool.wait();
+
+  int res = 0;
+  for (auto &job : jobs) {
+    con.out << job.diag.str();
+    con.err << job.trace.str();
+    con.llvmErr << job.llvmDiag;
+    con.ir << job.ir;
+    if (job.failed) res = 1;
+  }
+  return res;
+}
+
+// False, after saying why on err, if an argument is not understood
+static bool parseArgs(const std::vector<std::string> &args, Options &opts, std::ostream &err) {
+  size_t argc = args.size();
+  for (size_t i = 0; i<argc; i++) {
+    const std::string &arg = args[i];
+    if (arg == "-p")
+      opts.trace_parsing = true; // Abilita tracce debug nel parser
+    else if (arg == "-s")
+      opts.trace_scanning = true;// Abilita tracce debug nello scanner
+    else if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && '0' <= arg[2] && arg[2] <= '3')
+      opts.optLevel = arg[2] - '0';  // Livello di ottimizzazione -O0 ... -O3
+    else if (arg == "-c")
+      opts.outputKind = OutputKind::Object;
+    else if (arg == "-S")
+      opts.outputKind = OutputKind::Assembly;
+    else if (arg == "-emit-llvm")
+      opts.emitLLVM = true;
+    else if (arg == "-o" && i+1 < argc)
+      opts.outputFile = args[++i];
+    else if (arg == "--run")
+      opts.run = true;
+    else if (arg == "--entry" && i+1 < argc) {
+      opts.run = true;
+      opts.entry = args[++i];
+    }
+    else if (arg == "-j" && i+1 < argc)
+      opts.jobs = std::max(1, atoi(args[++i].c_str()));
+    else if (arg.size() > 2 && arg.compare(0, 2, "-j") == 0)
+      opts.jobs = std::max(1, atoi(arg.c_str() + 2));
+    else if (arg == "--parse-jobs" && i+1 < argc)
+      opts.parseJobs = std::max(1, atoi(args[++i].c_str()));
+    else if (arg == "--codegen-jobs" && i+1 < argc)
+      opts.codegenJobs = std::max(1, atoi(args[++i].c_str()));
+    else if (arg == "--backend-jobs" && i+1 < argc)
+      opts.backendJobs = std::max(1, atoi(args[++i].c_str()));
+    else if (arg == "--server" && i+1 < argc)
+      opts.server = args[++i];
+    else if (arg == "--cache" && i+1 < argc)
+      opts.cacheDir = args[++i];
+    else if (arg == "--fast-math")
+      opts.fastMath = true;
+    else if (arg == "--time")
+      opts.time = true;
+    else if (arg == "--stream")
+      opts.stream = true;
+    else if (arg == "--parse-only")
+      opts.parseOnly = true;
+    else if (arg == "--lexer" && i+1 < argc && (args[i+1] == "flex" || args[i+1] == "hand"))
+      opts.flex = args[++i] == "flex";
+    else if (arg == "--parser" && i+1 < argc && (args[i+1] == "bison" || args[i+1] == "pratt"))
+      opts.pratt = args[++i] == "pratt";
+    else if (arg.size() > 1 && arg[0] == '-') {
+      err << "Unknown option: " << arg << std::endl;
+      return false;
+    } else
+      opts.files.push_back(arg);
   };
+  return true;
+}
+
+static int compile(const Options &opts, Console &con) {
+  if (opts.stream) return compileStreaming(opts, con);
+  return opts.jobs ? compileSeparately(opts, con) : compileTogether(opts, con);
+}
+
+// A request of a kcomp --connect client, compiled in the server process. Paths
+// are taken relative to the client's directory, as the server may run elsewhere.
+static int serveRequest(const std::string &cwd, const std::vector<std::string> &args, std::ostream &out, std::ostream &err) {
+  Options opts;
+  if (not parseArgs(args, opts, err)) return 1;
+  if (opts.run || not opts.server.empty()) {
+    err << "--run and --server cannot be forwarded to a server" << std::endl;
+    return 1;
+  }
+
+  auto absolute = [&](std::string &path) {
+    SmallString<256> p(path);
+    sys::fs::make_absolute(cwd, p);
+    path = p.str().str();
+  };
+  for (auto &f : opts.files) {
+    if (f.empty() || f == "-") {
+      err << "the server cannot read the client's standard input" << std::endl;
+      return 1;
+    }
+    absolute(f);
+  }
+  if (opts.outputFile == "-") {
+    err << "the server cannot write to the client's standard output" << std::endl;
+    return 1;
+  }
+  if (not opts.outputFile.empty()) absolute(opts.outputFile);
+  if (not opts.cacheDir.empty()) absolute(opts.cacheDir);
+  opts.outputDir = cwd;  // Default outputs, named after the inputs
+
+  raw_os_ostream ir(err);
+  ir.SetUnbuffered();  // Interleaved with errors written straight to err
+  Console con{out, err, ir, ir};
+  int res = compile(opts, con);
+  ir.flush();
   return res;
 }
+
+int main (int argc, char *argv[]) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+
+  // The client forwards everything else as it is: it does not even set LLVM up
+  if (args.size() >= 2 && args[0] == "--connect")
+    return runClient(args[1], std::vector<std::string>(args.begin() + 2, args.end()));
+
+  Options opts;
+  if (not parseArgs(args, opts, std::cerr)) return 1;
+
+  if (not opts.server.empty()) {
+    // Targets are registered once, before the first request
+    if (not createHostTargetMachine(opts.optLevel, errs())) return 1;
+    return runServer(opts.server, opts.jobs, serveRequest);
+  }
+
+  Console con{std::cout, std::cerr, errs(), errs()};
+  return compile(opts, con);
+}
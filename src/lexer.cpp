@@ -0,0 +1,283 @@
+#include "lexer.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+#include "driver.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Character classes, one byte at a time
+static bool isBlankChar(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+static bool isDigitChar(char c) { return '0' <= c && c <= '9'; }
+static bool isAlphaChar(char c) { return ('a' <= (c | 0x20) && (c | 0x20) <= 'z'); }
+static bool isIdentChar(char c) { return isAlphaChar(c) || isDigitChar(c) || c == '_'; }
+
+#if defined(__SSE2__)
+// One bit per byte of the 16 at p, set where the class holds
+static unsigned blankMask(__m128i chunk) {
+  __m128i blank = _mm_or_si128(
+    _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t'))),
+    _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'))));
+  return _mm_movemask_epi8(blank);
+}
+
+static unsigned identMask(__m128i chunk) {
+  // Bytes are signed: anything above 0x7f is below every bound
+  auto inRange = [](__m128i x, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8(hi + 1)));
+  };
+  __m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+  __m128i ident = _mm_or_si128(
+    _mm_or_si128(inRange(lower, 'a', 'z'), inRange(chunk, '0', '9')),
+    _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_')));
+  return _mm_movemask_epi8(ident);
+}
+#endif
+
+// Skips blanks, keeping loc in step with the newlines crossed
+static const char *skipBlanks(const char *p, const char *end, yy::location &loc) {
+  const char *start = p, *lineStart = nullptr;
+  unsigned lines = 0;
+#if defined(__SSE2__)
+  for (; end - p >= 16; p += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    unsigned run = __builtin_ctz(~blankMask(chunk) | 0x10000);  // Leading blanks
+    unsigned newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'))) & ((1u << run) - 1);
+    if (newlines) {
+      lines += __builtin_popcount(newlines);
+      lineStart = p + (31 - __builtin_clz(newlines)) + 1;
+    }
+    if (run < 16) {
+      p += run;
+      goto done;
+    }
+  }
+#endif
+  for (; p < end && isBlankChar(*p); p++)
+    if (*p == '\n') {
+      lines++;
+      lineStart = p + 1;
+    }
+#if defined(__SSE2__)
+done:
+#endif
+  if (lines) {
+    loc.lines(lines);
+    loc.columns(p - lineStart);
+  }
+  else
+    loc.columns(p - start);
+  loc.step();
+  return p;
+}
+
+// End of the comment starting at p: the next newline, which is not part of it
+static const char *skipComment(const char *p, const char *end) {
+#if defined(__SSE2__)
+  for (; end - p >= 16; p += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    if (unsigned newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'))))
+      return p + __builtin_ctz(newlines);
+  }
+#endif
+  while (p < end && *p != '\n') p++;
+  return p;
+}
+
+// End of the identifier run starting at p
+static const char *skipIdent(const char *p, const char *end) {
+#if defined(__SSE2__)
+  for (; end - p >= 16; p += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    unsigned run = __builtin_ctz(~identMask(chunk) | 0x10000);
+    if (run < 16) return p + run;
+  }
+#endif
+  while (p < end && isIdentChar(*p)) p++;
+  return p;
+}
+
+// Decimal literal as matched by {num} in scanner.ll, converted exactly.
+// When the digits fit in 53 bits and the power of ten is at most 22, both are
+// exact doubles and a single multiplication or division rounds correctly
+// (Clinger's fast path). Other literals go through strtod.
+static const char *scanNumber(const char *p, const char *end, double &value, bool &inRange) {
+  static const double powersOf10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  const char *start = p;
+  uint64_t mantissa = 0;
+  int digits = 0;  // Significant digits in mantissa
+  int exp10 = 0;
+  bool exact = true;
+
+  auto digit = [&](char c) {
+    if (mantissa == 0 && c == '0') return;  // Leading zeros are not significant
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (c - '0');
+      digits++;
+    }
+    else {
+      exact = false;  // Would overflow: strtod will do
+      exp10++;
+    }
+  };
+
+  const char *intStart = p;
+  while (p < end && isDigitChar(*p)) digit(*p++);
+  size_t intDigits = p - intStart;
+  size_t fracDigits = 0;
+  if (p < end && *p == '.') {
+    const char *fracStart = p + 1;
+    const char *q = fracStart;
+    while (q < end && isDigitChar(*q)) q++;
+    fracDigits = q - fracStart;
+    // "5." is a number, "007." is "007" then "."
+    if (fracDigits || (intDigits == 1 || (intDigits > 1 && *intStart != '0'))) {
+      for (const char *f = fracStart; f < q; f++) {
+        digit(*f);
+        exp10--;
+      }
+      p = q;
+    }
+  }
+
+  // The exponent needs a digit right before it, and digits after it
+  if (p < end && (*p == 'e' || *p == 'E') && isDigitChar(p[-1])) {
+    const char *q = p + 1;
+    bool negative = false;
+    if (q < end && (*q == '-' || *q == '+')) negative = *q++ == '-';
+    if (q < end && isDigitChar(*q)) {
+      int e = 0;
+      for (; q < end && isDigitChar(*q); q++)
+        if (e < 100000) e = e * 10 + (*q - '0');
+      exp10 += negative ? -e : e;
+      p = q;
+    }
+  }
+
+  inRange = true;
+  if (exact && (mantissa == 0 || (mantissa <= (uint64_t(1) << 53) && -22 <= exp10 && exp10 <= 22))) {
+    double m = double(mantissa);
+    value = exp10 < 0 ? m / powersOf10[-exp10] : m * powersOf10[exp10];
+    return p;
+  }
+
+  std::string text(start, p);  // strtod needs a terminator
+  errno = 0;
+  value = strtod(text.c_str(), nullptr);
+  inRange = value != HUGE_VAL && value != -HUGE_VAL && errno != ERANGE;
+  return p;
+}
+
+yy::parser::symbol_type Lexer::next(driver &drv) {
+  const char *start = cur;
+  auto token = scan(drv);
+  if (drv.trace_scanning)
+    *drv.trace << "--scanned " << drv.location << ": \"" << std::string_view(start, cur - start) << "\"\n";
+  return token;
+}
+
+yy::parser::symbol_type Lexer::scan(driver &drv) {
+  yy::location &loc = drv.location;
+  loc.step();
+
+  for (;;) {
+    cur = skipBlanks(cur, end, loc);
+    if (cur == end) return yy::parser::make_END(loc);
+    if (*cur != '#') break;
+    const char *eol = skipComment(cur, end);
+    loc.columns(eol - cur);
+    loc.step();
+    cur = eol;
+  }
+
+  const char *start = cur;
+  auto take = [&](size_t len) {
+    cur = start + len;
+    loc.columns(len);
+  };
+  char next = cur + 1 < end ? cur[1] : '\0';
+
+  switch (*cur) {
+  case '-':
+    if (next == '-') { take(2); return yy::parser::make_DECREMENT(loc); }
+    take(1); return yy::parser::make_MINUS(loc);
+  case '+':
+    if (next == '+') { take(2); return yy::parser::make_INCREMENT(loc); }
+    take(1); return yy::parser::make_PLUS(loc);
+  case '=':
+    if (next == '=') { take(2); return yy::parser::make_EQ(loc); }
+    take(1); return yy::parser::make_ASSIGN(loc);
+  case '*': take(1); return yy::parser::make_STAR(loc);
+  case '/': take(1); return yy::parser::make_SLASH(loc);
+  case '(': take(1); return yy::parser::make_LPAREN(loc);
+  case ')': take(1); return yy::parser::make_RPAREN(loc);
+  case ';': take(1); return yy::parser::make_SEMICOLON(loc);
+  case ',': take(1); return yy::parser::make_COMMA(loc);
+  case '?': take(1); return yy::parser::make_QMARK(loc);
+  case ':': take(1); return yy::parser::make_COLON(loc);
+  case '<': take(1); return yy::parser::make_LT(loc);
+  case '>': take(1); return yy::parser::make_GT(loc);
+  case '{': take(1); return yy::parser::make_LBRACE(loc);
+  case '}': take(1); return yy::parser::make_RBRACE(loc);
+  case '[': take(1); return yy::parser::make_LSBRACKET(loc);
+  case ']': take(1); return yy::parser::make_RSBRACKET(loc);
+  }
+
+  if (isDigitChar(*cur) || (*cur == '.' && isDigitChar(next))) {
+    double value;
+    bool inRange;
+    take(scanNumber(cur, end, value, inRange) - start);
+    if (not inRange) {
+      // Reported by the parser, once, as the flex scanner does
+      throw yy::parser::syntax_error(loc, "Float value is out of range: " + std::string(start, cur - start));
+    }
+    return yy::parser::make_NUMBER(value, loc);
+  }
+
+  if (isAlphaChar(*cur)) {
+    take(skipIdent(cur + 1, end) - start);
+    llvm::StringRef word(start, cur - start);
+    switch (word.size()) {
+    case 2:
+      if (word == "if") return yy::parser::make_IF(loc);
+      if (word == "or") return yy::parser::make_OR(loc);
+      break;
+    case 3:
+      if (word == "def") return yy::parser::make_DEF(loc);
+      if (word == "var") return yy::parser::make_VAR(loc);
+      if (word == "for") return yy::parser::make_FOR(loc);
+      if (word == "not") return yy::parser::make_NOT(loc);
+      if (word == "and") return yy::parser::make_AND(loc);
+      break;
+    case 4:
+      if (word == "else") return yy::parser::make_ELSE(loc);
+      break;
+    case 5:
+      if (word == "while") return yy::parser::make_WHILE(loc);
+      if (word == "break") return yy::parser::make_BREAK(loc);
+      break;
+    case 6:
+      if (word == "extern") return yy::parser::make_EXTERN(loc);
+      if (word == "global") return yy::parser::make_GLOBAL(loc);
+      if (word == "return") return yy::parser::make_RETURN(loc);
+      break;
+    case 8:
+      if (word == "continue") return yy::parser::make_CONTINUE(loc);
+      break;
+    }
+    return yy::parser::make_IDENTIFIER(drv.names.intern(word), loc);
+  }
+
+  take(1);
+  throw yy::parser::syntax_error(loc, "invalid character: " + std::string(start, 1));
+}
@@ -0,0 +1,27 @@
+#ifndef LEXER_HPP
+#define LEXER_HPP
+
+#include "llvm/ADT/StringRef.h"
+
+#include "parser.hpp"
+
+class driver;
+
+// Hand-written scanner over the whole input held in memory (see driver::source).
+// It accepts the same tokens as scanner.ll and tracks locations the same way.
+// Blanks, comments and identifier runs are skipped 16 bytes at a time with SSE2
+// when the target has it; numbers are converted without strtod in the common case.
+class Lexer {
+private:
+  const char *cur = nullptr;
+  const char *end = nullptr;
+
+  yy::parser::symbol_type scan(driver &drv);
+
+public:
+  void open(llvm::StringRef text) { cur = text.begin(); end = text.end(); };
+  void close() { cur = end = nullptr; };
+  yy::parser::symbol_type next(driver &drv);
+};
+
+#endif // ! LEXER_HPP
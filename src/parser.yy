@@ -1,5 +1,5 @@
 %skeleton "lalr1.cc"
-%require "3.2"
+%require "3.6"
 %defines
 
 %define api.token.constructor
@@ -10,6 +10,9 @@
 %code requires {
   #include <string>
   #include <exception>
+  #include <optional>
+  #include "symbols.hpp"
+  #include "types.hpp"
   class driver;
   class RootAST;
   class ExprAST;
@@ -24,8 +27,8 @@
   class GlobalVarAST;
   class AssignmentExprAST;
   class ForExprAST;
+  class WhileExprAST;
   class IfExprAST;
-  class InitAST;
   class BinaryExprAST;
   class UnaryExprAST;
   class SlicingExprAST;
@@ -70,6 +73,10 @@
   IF         "if"
   ELSE       "else"
   FOR        "for"
+  WHILE      "while"
+  BREAK      "break"
+  CONTINUE   "continue"
+  RETURN     "return"
   NOT        "not"
   OR         "or"
   AND        "and"
@@ -79,19 +86,21 @@
   INCREMENT  "++"
 ;
 
-%token <std::string> IDENTIFIER "id"
+%token <Ident> IDENTIFIER "id"
 %token <double> NUMBER "number"
 %type <ExprAST*> exp
 %type <ExprAST*> idexp
 %type <IfExprAST*> expif
 %type <std::vector<ExprAST*>> optexp
 %type <std::vector<ExprAST*>> explist
-%type <RootAST*> program
+%type <std::vector<RootAST*>> program
 %type <RootAST*> top
 %type <FunctionAST*> definition
 %type <PrototypeAST*> external
 %type <PrototypeAST*> proto
-%type <std::vector<std::string>> idseq
+%type <std::vector<Param>> params
+%type <Param> param
+%type <std::optional<ValueType>> opttype
 %type <BlockExprAST*> block
 %type <std::vector<VarBindingAST*>> vardefs
 %type <VarBindingAST*> binding
@@ -100,10 +109,11 @@
 %type <AssignmentExprAST*> assignment
 %type <ExprAST*> initexp
 %type <ExprAST*> stmt
-%type <SeqAST*> stmts
-%type <InitAST*> init
+%type <std::vector<RootAST*>> stmts
+%type <RootAST*> init
 %type <IfExprAST*> ifstmt
 %type <ForExprAST*> forstmt
+%type <WhileExprAST*> whilestmt
 %type <BinaryExprAST*> relexp
 %type <BinaryExprAST*> condexp
 %type <std::vector<ExprAST*>> vecinit
@@ -113,11 +123,16 @@
 %start startsymb;
 
 startsymb:
-  program               { drv.root = $1; }
+  program               { drv.root = drv.ast.make<SeqAST>(std::move($1)); }
 
+// Lists are left recursive and grow at the back: building them is linear and
+// the parser stack does not grow with their length.
+// Each top-level definition is reduced, and streamed if the driver asks so,
+// as soon as its ";" is read
 program:
-  %empty                { $$ = new SeqAST(nullptr, nullptr); }
-|  top ";" program      { $$ = new SeqAST($1, $3); };
+  %empty                { }
+| program top ";"       { $$ = std::move($1);
+                          if ($2 && !drv.streamTop($2)) $$.push_back($2); };
 
 top:
   %empty                { $$ = nullptr; }
@@ -126,21 +141,33 @@ top:
 | definition            { $$ = $1; };
 
 globalvar:
-  "global" "id"                   { $$ = new GlobalVarAST($2); }
-| "global" "id" "[" "number" "]"  { $$ = new GlobalVarAST($2, $4); };
+  "global" "id" opttype                   { $$ = drv.ast.make<GlobalVarAST>($2, $3.value_or(ValueType::Double), @2); }
+| "global" "id" "[" "number" "]" opttype  { $$ = drv.ast.make<GlobalVarAST>($2, $4, $6.value_or(ValueType::Double), @2); };
 
 external:
   "extern" proto        { $$ = $2; };
 
 definition:
-  "def" proto block     { $$ = new FunctionAST($2, $3); $2->noemit(); };
+  "def" proto block     { $$ = drv.ast.make<FunctionAST>($2, $3); };
 
 proto:
-  "id" "(" idseq ")"    { $$ = new PrototypeAST($1, $3); };
+  "id" "(" params ")" opttype   { $$ = drv.ast.make<PrototypeAST>($1, std::move($3), $5.value_or(ValueType::Double), @1); };
 
-idseq:
-  %empty                { $$ = std::vector<std::string>{}; }
-| "id" idseq            { $2.insert($2.begin(),$1); $$ = $2; };
+params:
+  %empty                { }
+| params param          { $$ = std::move($1); $$.push_back($2); };
+
+param:
+  "id" opttype          { $$ = {$1, $2.value_or(ValueType::Double)}; };
+
+// Type annotation; type names are not reserved words
+opttype:
+  %empty                { }
+| ":" "id"              { $$ = typeNamed($2.str());
+                          if (not $$) {
+                            error(@2, "unknown type " + $2.str().str() + ", expecting int, f32 or double");
+                            YYERROR;
+                          } };
 
 %left ":" "?";
 %left "or";
@@ -152,94 +179,101 @@ idseq:
 %nonassoc "--" "++";
 
 exp:
-  exp "+" exp           { $$ = new BinaryExprAST('+', $1, $3); }
-| exp "-" exp           { $$ = new BinaryExprAST('-', $1, $3); }
-| "-" exp               { $$ = new BinaryExprAST('-', new NumberExprAST(0), $2); }
-| exp "*" exp           { $$ = new BinaryExprAST('*', $1, $3); }
-| exp "/" exp           { $$ = new BinaryExprAST('/', $1, $3); }
+  exp "+" exp           { $$ = drv.ast.make<BinaryExprAST>('+', $1, $3); }
+| exp "-" exp           { $$ = drv.ast.make<BinaryExprAST>('-', $1, $3); }
+| "-" exp               { $$ = drv.ast.make<UnaryExprAST>('-', $2); }
+| exp "*" exp           { $$ = drv.ast.make<BinaryExprAST>('*', $1, $3); }
+| exp "/" exp           { $$ = drv.ast.make<BinaryExprAST>('/', $1, $3); }
 | idexp                 { $$ = $1; }
 | "(" exp ")"           { $$ = $2; }
-| "number"              { $$ = new NumberExprAST($1); }
+| "number"              { $$ = drv.ast.make<NumberExprAST>($1); }
 | expif                 { $$ = $1; };
 
 stmts:
-  stmt                  { $$ = new SeqAST($1, nullptr); };
-| stmt ";" stmts        { $$ = new SeqAST($1, $3); };
+  stmt                  { $$.push_back($1); }
+| stmts ";" stmt        { $$ = std::move($1); $$.push_back($3); };
 
 stmt:
   assignment            { $$ = $1; }
 | block                 { $$ = $1; }
 | ifstmt                { $$ = $1; }
 | forstmt               { $$ = $1; }
+| whilestmt             { $$ = $1; }
+| "break"               { $$ = drv.ast.make<JumpExprAST>(ASTKind::Break, @1); }
+| "continue"            { $$ = drv.ast.make<JumpExprAST>(ASTKind::Continue, @1); }
+| "return" exp          { $$ = drv.ast.make<ReturnExprAST>($2); }
 | exp                   { $$ = $1; };
 
 ifstmt:
-  "if" "(" condexp ")" stmt               { $$ = new IfExprAST($3, $5, nullptr); }
-| "if" "(" condexp ")" stmt "else" stmt   { $$ = new IfExprAST($3, $5, $7); };
+  "if" "(" condexp ")" stmt               { $$ = drv.ast.make<IfExprAST>($3, $5, nullptr); }
+| "if" "(" condexp ")" stmt "else" stmt   { $$ = drv.ast.make<IfExprAST>($3, $5, $7); };
 
 forstmt:
-  "for" "(" init ";" condexp ";" assignment ")" stmt  { $$ = new ForExprAST($3, $5, $7, $9); };
+  "for" "(" init ";" condexp ";" assignment ")" stmt  { $$ = drv.ast.make<ForExprAST>($3, $5, $7, $9); };
+
+whilestmt:
+  "while" "(" condexp ")" stmt  { $$ = drv.ast.make<WhileExprAST>($3, $5); };
 
 init:
   binding                       { $$ = $1; }
 | assignment                    { $$ = $1; };
 
 assignment:
-  "id" "=" exp                  { $$ = new AssignmentExprAST($1, $3); }
-| "id" "[" exp "]" "=" exp      { $$ = new AssignmentExprAST($1, $6, $3); }
-| "--" "id"                     { $$ = new UnaryDecrementAST($2); }
-| "++" "id"                     { $$ = new UnaryIncrementAST($2); };
+  "id" "=" exp                  { $$ = drv.ast.make<AssignmentExprAST>($1, $3, nullptr, @1); }
+| "id" "[" exp "]" "=" exp      { $$ = drv.ast.make<AssignmentExprAST>($1, $6, $3, @1); }
+| "--" "id"                     { $$ = drv.ast.make<UnaryDecrementAST>(drv.ast, $2, @2); }
+| "++" "id"                     { $$ = drv.ast.make<UnaryIncrementAST>(drv.ast, $2, @2); };
 
 block:
-  "{" stmts "}"                 { $$ = new BlockExprAST({}, $2); }
-| "{" vardefs ";" stmts "}"     { $$ = new BlockExprAST($2, $4); };
+  "{" stmts "}"                 { $$ = drv.ast.make<BlockExprAST>(std::vector<VarBindingAST*>{}, drv.ast.make<SeqAST>(std::move($2))); }
+| "{" vardefs ";" stmts "}"     { $$ = drv.ast.make<BlockExprAST>(std::move($2), drv.ast.make<SeqAST>(std::move($4))); };
   
 vardefs:
-  binding                       { $$ = std::vector<VarBindingAST*>{$1}; }
-| vardefs ";" binding           { $1.push_back($3); $$ = $1; };
+  binding                       { $$.push_back($1); }
+| vardefs ";" binding           { $$ = std::move($1); $$.push_back($3); };
                             
 binding:
-  "var" "id" initexp                    { $$ = new VarBindingAST($2, $3); }
-| "var" "id" "[" "number" "]" vecinit   { $$ = new VarBindingAST($2, $6, $4); };
+  "var" "id" opttype initexp                    { $$ = drv.ast.make<VarBindingAST>($2, $4, $3); }
+| "var" "id" "[" "number" "]" opttype vecinit   { $$ = drv.ast.make<VarBindingAST>($2, std::move($7), $4, $6); };
 
 initexp:
   %empty                        { $$ = nullptr; }
 | "=" exp                       { $$ = $2; };
 
 vecinit:
-  %empty                        { $$ = std::vector<ExprAST*>{}; }
-| "=" "{" explist "}"           { $$ = $3; };
+  %empty                        { }
+| "=" "{" explist "}"           { $$ = std::move($3); };
 
 expif:
-  condexp "?" exp ":" exp       { $$ = new IfExprAST($1, $3, $5); };
+  condexp "?" exp ":" exp       { $$ = drv.ast.make<IfExprAST>($1, $3, $5); };
 
 condexp:
   relexp                        { $$ = $1; }
-| relexp "and" condexp          { $$ = new BinaryExprAST('&', $1, $3); }
-| relexp "or" condexp           { $$ = new BinaryExprAST('|', $1, $3); }
-| "not" condexp                 { $$ = new UnaryExprAST('!', $2); }
+| relexp "and" condexp          { $$ = drv.ast.make<BinaryExprAST>('&', $1, $3); }
+| relexp "or" condexp           { $$ = drv.ast.make<BinaryExprAST>('|', $1, $3); }
+| "not" condexp                 { $$ = drv.ast.make<UnaryExprAST>('!', $2); }
 | "(" condexp ")"               { $$ = $2; };
 
 relexp:
-  exp "<" exp                   { $$ = new BinaryExprAST('<', $1, $3); }
-| exp ">" exp                   { $$ = new BinaryExprAST('>', $1, $3); }
-| exp "==" exp                  { $$ = new BinaryExprAST('=', $1, $3); };
+  exp "<" exp                   { $$ = drv.ast.make<BinaryExprAST>('<', $1, $3); }
+| exp ">" exp                   { $$ = drv.ast.make<BinaryExprAST>('>', $1, $3); }
+| exp "==" exp                  { $$ = drv.ast.make<BinaryExprAST>('=', $1, $3); };
 
 idexp:
-  "id"                          { $$ = new VariableExprAST($1); }
-| "id" "(" optexp ")"           { $$ = new CallExprAST($1, $3); }
-| "id" "[" exp "]"              { $$ = new SlicingExprAST($1, $3); };
+  "id"                          { $$ = drv.ast.make<VariableExprAST>($1, @1); }
+| "id" "(" optexp ")"           { $$ = drv.ast.make<CallExprAST>($1, std::move($3), @1); }
+| "id" "[" exp "]"              { $$ = drv.ast.make<SlicingExprAST>($1, $3, @1); };
 
 optexp:
-  %empty                        { $$ = std::vector<ExprAST*>{}; }
-| explist                       { $$ = $1; };
+  %empty                        { }
+| explist                       { $$ = std::move($1); };
 
 explist:
-  exp                           { $$ = std::vector<ExprAST*>{$1}; }
-| exp "," explist               { $3.insert($3.begin(), $1); $$ = $3; };
+  exp                           { $$.push_back($1); }
+| explist "," exp               { $$ = std::move($1); $$.push_back($3); };
  
 %%
 
 void yy::parser::error(const location_type &l, const std::string &m) {
-  std::cerr << l << ": " << m << '\n';
+  *drv.diag << l << ": " << m << '\n';
 }
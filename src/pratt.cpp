@@ -0,0 +1,416 @@
+#include "pratt.hpp"
+
+#include <utility>
+#include <vector>
+
+#include "driver.hpp"
+
+using Kind = yy::parser::symbol_kind;
+
+int PrattParser::parse() {
+  std::vector<RootAST*> tops;
+  while (peek().kind != Kind::S_YYEOF) {
+    RootAST *top = nullptr;
+    switch (peek().kind) {
+    case Kind::S_SEMICOLON: break;  // Empty definition
+    case Kind::S_GLOBAL:    top = parseGlobal(); break;
+    case Kind::S_EXTERN:    take(); top = parseProto(); break;
+    case Kind::S_DEF:       top = parseDefinition(); break;
+    default:                error("def, extern, global or ;"); break;
+    }
+    if (failed || not expect(Kind::S_SEMICOLON))
+      return 1;
+    if (top && !drv.streamTop(top)) tops.push_back(top);
+  }
+  drv.root = drv.ast.make<SeqAST>(std::move(tops));
+  return 0;
+}
+
+const PrattParser::Token &PrattParser::peek() {
+  if (not pending) {
+    try {
+      auto symbol = yylex(drv);
+      tok.kind = symbol.kind();
+      tok.loc = symbol.location;
+      if (tok.kind == Kind::S_NUMBER) tok.number = symbol.value.as<double>();
+      else if (tok.kind == Kind::S_IDENTIFIER) tok.ident = symbol.value.as<Ident>();
+    } catch (const yy::parser::syntax_error &e) {
+      // A lexical error: reported as yy::parser::parse does, then every rule
+      // sees an error token that it cannot accept
+      tok.kind = Kind::S_YYerror;
+      tok.loc = e.location;
+      if (not failed) *drv.diag << e.location << ": " << e.what() << '\n';
+      failed = true;
+    }
+    pending = true;
+  }
+  return tok;
+}
+
+bool PrattParser::accept(yy::parser::symbol_kind_type kind) {
+  if (peek().kind != kind) return false;
+  pending = false;
+  return true;
+}
+
+bool PrattParser::expect(yy::parser::symbol_kind_type kind, Token *out) {
+  if (peek().kind != kind) {
+    error(yy::parser::symbol_name(kind).c_str());
+    return false;
+  }
+  if (out) *out = tok;
+  pending = false;
+  return true;
+}
+
+void PrattParser::error(const char *expecting) {
+  if (failed) return;  // Only the first one, as Bison
+  failed = true;
+  peek();
+  *drv.diag << tok.loc << ": syntax error, unexpected " << yy::parser::symbol_name(tok.kind);
+  if (expecting) *drv.diag << ", expecting " << expecting;
+  *drv.diag << '\n';
+}
+
+
+bool PrattParser::parseType(std::optional<ValueType> &type) {
+  Token name;
+  if (not accept(Kind::S_COLON)) return true;
+  if (not expect(Kind::S_IDENTIFIER, &name)) return false;
+  type = typeNamed(name.ident.str());
+  if (not type) {
+    failed = true;
+    *drv.diag << name.loc << ": unknown type " << name.ident.str().str() << ", expecting int, f32 or double\n";
+  }
+  return bool(type);
+}
+
+RootAST *PrattParser::parseGlobal() {
+  Token id, size;
+  std::optional<ValueType> type;
+  take();
+  if (not expect(Kind::S_IDENTIFIER, &id)) return nullptr;
+  if (not accept(Kind::S_LSBRACKET)) {
+    if (not parseType(type)) return nullptr;
+    return drv.ast.make<GlobalVarAST>(id.ident, type.value_or(ValueType::Double), id.loc);
+  }
+  if (not expect(Kind::S_NUMBER, &size) || not expect(Kind::S_RSBRACKET) || not parseType(type)) return nullptr;
+  return drv.ast.make<GlobalVarAST>(id.ident, size.number, type.value_or(ValueType::Double), id.loc);
+}
+
+PrototypeAST *PrattParser::parseProto() {
+  Token id;
+  if (not expect(Kind::S_IDENTIFIER, &id) || not expect(Kind::S_LPAREN)) return nullptr;
+  std::vector<Param> params;
+  while (peek().kind == Kind::S_IDENTIFIER) {
+    Ident name = take().ident;
+    std::optional<ValueType> type;
+    if (not parseType(type)) return nullptr;
+    params.push_back({name, type.value_or(ValueType::Double)});
+  }
+  std::optional<ValueType> ret;
+  if (not expect(Kind::S_RPAREN) || not parseType(ret)) return nullptr;
+  return drv.ast.make<PrototypeAST>(id.ident, std::move(params), ret.value_or(ValueType::Double), id.loc);
+}
+
+FunctionAST *PrattParser::parseDefinition() {
+  take();
+  PrototypeAST *proto = parseProto();
+  if (not proto) return nullptr;
+  BlockExprAST *body = parseBlock();
+  if (not body) return nullptr;
+  return drv.ast.make<FunctionAST>(proto, body);
+}
+
+BlockExprAST *PrattParser::parseBlock() {
+  if (not expect(Kind::S_LBRACE)) return nullptr;
+  // Bindings come first, each followed by ";"
+  std::vector<VarBindingAST*> defs;
+  while (peek().kind == Kind::S_VAR) {
+    VarBindingAST *def = parseBinding();
+    if (not def || not expect(Kind::S_SEMICOLON)) return nullptr;
+    defs.push_back(def);
+  }
+  std::vector<RootAST*> stmts;
+  do {
+    ExprAST *stmt = parseStmt();
+    if (not stmt) return nullptr;
+    stmts.push_back(stmt);
+  } while (accept(Kind::S_SEMICOLON));
+  if (not expect(Kind::S_RBRACE)) return nullptr;
+  return drv.ast.make<BlockExprAST>(std::move(defs), drv.ast.make<SeqAST>(std::move(stmts)));
+}
+
+VarBindingAST *PrattParser::parseBinding() {
+  Token id, size;
+  std::optional<ValueType> type;
+  take();
+  if (not expect(Kind::S_IDENTIFIER, &id)) return nullptr;
+  if (accept(Kind::S_LSBRACKET)) {
+    if (not expect(Kind::S_NUMBER, &size) || not expect(Kind::S_RSBRACKET) || not parseType(type)) return nullptr;
+    std::vector<ExprAST*> init;
+    if (accept(Kind::S_ASSIGN)) {
+      if (not expect(Kind::S_LBRACE)) return nullptr;
+      do {
+        ExprAST *elem = parseExp();
+        if (not elem) return nullptr;
+        init.push_back(elem);
+      } while (accept(Kind::S_COMMA));
+      if (not expect(Kind::S_RBRACE)) return nullptr;
+    }
+    return drv.ast.make<VarBindingAST>(id.ident, std::move(init), size.number, type);
+  }
+  if (not parseType(type)) return nullptr;
+  ExprAST *val = nullptr;
+  if (accept(Kind::S_ASSIGN) && not (val = parseExp())) return nullptr;
+  return drv.ast.make<VarBindingAST>(id.ident, val, type);
+}
+
+ExprAST *PrattParser::parseStmt() {
+  switch (peek().kind) {
+  case Kind::S_LBRACE:    return parseBlock();
+  case Kind::S_IF:        return parseIf();
+  case Kind::S_FOR:       return parseFor();
+  case Kind::S_WHILE:     return parseWhile();
+  case Kind::S_BREAK:     return drv.ast.make<JumpExprAST>(ASTKind::Break, take().loc);
+  case Kind::S_CONTINUE:  return drv.ast.make<JumpExprAST>(ASTKind::Continue, take().loc);
+  case Kind::S_RETURN: {
+    take();
+    ExprAST *val = parseExp();
+    return val ? drv.ast.make<ReturnExprAST>(val) : nullptr;
+  }
+  case Kind::S_DECREMENT:
+  case Kind::S_INCREMENT: return parseAssignment();
+  case Kind::S_IDENTIFIER: break;
+  default:                return parseExp();
+  }
+
+  // "id" starts an assignment or an expression: "=" tells them apart,
+  // after the index for an element of an array
+  Token id = take();
+  if (accept(Kind::S_ASSIGN)) {
+    ExprAST *val = parseExp();
+    return val ? drv.ast.make<AssignmentExprAST>(id.ident, val, nullptr, id.loc) : nullptr;
+  }
+  Operand lhs;
+  if (accept(Kind::S_LSBRACKET)) {
+    ExprAST *idx = parseExp();
+    if (not idx || not expect(Kind::S_RSBRACKET)) return nullptr;
+    if (accept(Kind::S_ASSIGN)) {
+      ExprAST *val = parseExp();
+      return val ? drv.ast.make<AssignmentExprAST>(id.ident, val, idx, id.loc) : nullptr;
+    }
+    lhs.expr = drv.ast.make<SlicingExprAST>(id.ident, idx, id.loc);
+  }
+  else
+    lhs = parseIdSuffix(id);
+  return requireArith(parseBinary(lhs, Ternary));
+}
+
+ExprAST *PrattParser::parseIf() {
+  take();
+  if (not expect(Kind::S_LPAREN)) return nullptr;
+  ExprAST *cond = parseCond();
+  if (not cond || not expect(Kind::S_RPAREN)) return nullptr;
+  ExprAST *trueStmt = parseStmt();
+  if (not trueStmt) return nullptr;
+  ExprAST *falseStmt = nullptr;
+  if (accept(Kind::S_ELSE) && not (falseStmt = parseStmt())) return nullptr;  // Nearest "if"
+  return drv.ast.make<IfExprAST>(cond, trueStmt, falseStmt);
+}
+
+ExprAST *PrattParser::parseFor() {
+  take();
+  if (not expect(Kind::S_LPAREN)) return nullptr;
+  RootAST *init;
+  if (peek().kind == Kind::S_VAR) init = parseBinding();
+  else init = parseAssignment();
+  if (not init || not expect(Kind::S_SEMICOLON)) return nullptr;
+  ExprAST *cond = parseCond();
+  if (not cond || not expect(Kind::S_SEMICOLON)) return nullptr;
+  AssignmentExprAST *step = parseAssignment();
+  if (not step || not expect(Kind::S_RPAREN)) return nullptr;
+  ExprAST *body = parseStmt();
+  if (not body) return nullptr;
+  return drv.ast.make<ForExprAST>(init, cond, step, body);
+}
+
+ExprAST *PrattParser::parseWhile() {
+  take();
+  if (not expect(Kind::S_LPAREN)) return nullptr;
+  ExprAST *cond = parseCond();
+  if (not cond || not expect(Kind::S_RPAREN)) return nullptr;
+  ExprAST *body = parseStmt();
+  if (not body) return nullptr;
+  return drv.ast.make<WhileExprAST>(cond, body);
+}
+
+AssignmentExprAST *PrattParser::parseAssignment() {
+  Token id;
+  if (accept(Kind::S_DECREMENT))
+    return expect(Kind::S_IDENTIFIER, &id) ? drv.ast.make<UnaryDecrementAST>(drv.ast, id.ident, id.loc) : nullptr;
+  if (accept(Kind::S_INCREMENT))
+    return expect(Kind::S_IDENTIFIER, &id) ? drv.ast.make<UnaryIncrementAST>(drv.ast, id.ident, id.loc) : nullptr;
+
+  if (not expect(Kind::S_IDENTIFIER, &id)) return nullptr;
+  ExprAST *idx = nullptr;
+  if (accept(Kind::S_LSBRACKET) && (not (idx = parseExp()) || not expect(Kind::S_RSBRACKET)))
+    return nullptr;
+  if (not expect(Kind::S_ASSIGN)) return nullptr;
+  ExprAST *val = parseExp();
+  return val ? drv.ast.make<AssignmentExprAST>(id.ident, val, idx, id.loc) : nullptr;
+}
+
+
+ExprAST *PrattParser::parseExp() {
+  return requireArith(parseBinary(parseUnary(), Ternary));
+}
+
+ExprAST *PrattParser::parseCond() {
+  return requireCond(parseBinary(parseUnary(), Ternary));
+}
+
+ExprAST *PrattParser::requireArith(Operand o) {
+  if (o.expr && o.form != Form::Arith) {
+    error(o.form == Form::Relation ? "and, or or ?" : "?");
+    return nullptr;
+  }
+  return o.expr;
+}
+
+ExprAST *PrattParser::requireCond(Operand o) {
+  if (o.expr && o.form == Form::Arith) {
+    error("<, > or ==");
+    return nullptr;
+  }
+  return o.expr;
+}
+
+PrattParser::Operand PrattParser::parseUnary() {
+  Operand o;
+  switch (peek().kind) {
+  case Kind::S_NUMBER:
+    o.expr = drv.ast.make<NumberExprAST>(take().number);
+    return o;
+  case Kind::S_IDENTIFIER:
+    return parseIdSuffix(take());
+  case Kind::S_LPAREN:
+    take();
+    o = parseBinary(parseUnary(), Ternary);
+    if (o.expr && not expect(Kind::S_RPAREN)) o.expr = nullptr;
+    if (o.form == Form::Relation) o.form = Form::Condition;  // No longer a relexp
+    return o;
+  case Kind::S_MINUS:
+    // Binds as the binary "-": "-a*b" is -(a*b), "-a+b" is (-a)+b
+    take();
+    if ((o.expr = parseOperand(Multiplicative, false)))
+      o.expr = drv.ast.make<UnaryExprAST>('-', o.expr);
+    return o;
+  case Kind::S_NOT:
+    // Applies to the whole condition that follows, "and" and "or" included
+    take();
+    if ((o.expr = requireCond(parseBinary(parseUnary(), Logical))))
+      o.expr = drv.ast.make<UnaryExprAST>('!', o.expr);
+    o.form = Form::Condition;
+    return o;
+  default:
+    error("an expression");
+    return o;
+  }
+}
+
+PrattParser::Operand PrattParser::parseIdSuffix(const Token &id) {
+  Operand o;
+  if (accept(Kind::S_LPAREN)) {
+    std::vector<ExprAST*> args;
+    if (peek().kind != Kind::S_RPAREN)
+      do {
+        ExprAST *arg = parseExp();
+        if (not arg) return o;
+        args.push_back(arg);
+      } while (accept(Kind::S_COMMA));
+    if (expect(Kind::S_RPAREN))
+      o.expr = drv.ast.make<CallExprAST>(id.ident, std::move(args), id.loc);
+  }
+  else if (accept(Kind::S_LSBRACKET)) {
+    ExprAST *idx = parseExp();
+    if (idx && expect(Kind::S_RSBRACKET))
+      o.expr = drv.ast.make<SlicingExprAST>(id.ident, idx, id.loc);
+  }
+  else
+    o.expr = drv.ast.make<VariableExprAST>(id.ident, id.loc);
+  return o;
+}
+
+// Right operand of an arithmetic or relational operator, or of unary "-",
+// made of the operators from min up. Where the grammar cannot end such an
+// operand, Bison goes on with it as the head of a "?:" instead: a condition
+// always does, and so does a relation right of another one. "1 + (a < b) ? x : y"
+// is 1 + ((a < b) ? x : y), "a < b < c ? x : y" is a < (b < c ? x : y).
+ExprAST *PrattParser::parseOperand(Level min, bool afterRelation) {
+  Operand o = parseBinary(parseUnary(), min);
+  if (o.expr && (o.form != Form::Arith || (afterRelation && levelOf(peek().kind) == Relational)))
+    o = parseBinary(o, Ternary);
+  return requireArith(o);
+}
+
+PrattParser::Level PrattParser::levelOf(yy::parser::symbol_kind_type kind) {
+  switch (kind) {
+  case Kind::S_QMARK:                                     return Ternary;
+  case Kind::S_AND: case Kind::S_OR:                      return Logical;
+  case Kind::S_LT: case Kind::S_GT: case Kind::S_EQ:      return Relational;
+  case Kind::S_PLUS: case Kind::S_MINUS:                  return Additive;
+  case Kind::S_STAR: case Kind::S_SLASH:                  return Multiplicative;
+  default:                                                return None;
+  }
+}
+
+// Extends lhs with the infix operators binding at least as tight as min
+PrattParser::Operand PrattParser::parseBinary(Operand lhs, Level min) {
+  while (lhs.expr) {
+    Level level = levelOf(peek().kind);
+    if (level == None || level < min)
+      break;
+
+    // An operator that does not apply to lhs is left to an enclosing rule:
+    // in "a < b < c ? x : y ? z : w" the second "?" ends the inner "?:".
+    // If none takes it, the caller reports it as unexpected.
+    bool applies = level == Ternary ? lhs.form != Form::Arith
+                 : level == Logical ? lhs.form == Form::Relation
+                 : lhs.form == Form::Arith;
+    if (not applies)
+      break;
+    Token op = take();
+
+    if (level == Ternary) {
+      ExprAST *trueExp = parseExp();
+      if (not trueExp || not expect(Kind::S_COLON)) { lhs.expr = nullptr; break; }
+      ExprAST *falseExp = parseExp();
+      lhs.expr = falseExp ? drv.ast.make<IfExprAST>(lhs.expr, trueExp, falseExp) : nullptr;
+      lhs.form = Form::Arith;
+      continue;
+    }
+
+    char opChar;
+    switch (op.kind) {
+    case Kind::S_AND: opChar = '&'; break;
+    case Kind::S_OR:  opChar = '|'; break;
+    case Kind::S_EQ:  opChar = '='; break;
+    case Kind::S_LT:  opChar = '<'; break;
+    case Kind::S_GT:  opChar = '>'; break;
+    case Kind::S_PLUS:  opChar = '+'; break;
+    case Kind::S_MINUS: opChar = '-'; break;
+    case Kind::S_STAR:  opChar = '*'; break;
+    default:            opChar = '/'; break;
+    }
+
+    // "and" and "or" are right associative and take a condition on the right;
+    // arithmetic operators are left associative
+    ExprAST *rhs;
+    if (level == Logical) rhs = requireCond(parseBinary(parseUnary(), Logical));
+    else rhs = parseOperand(Level(level + 1), level == Relational);
+    lhs.expr = rhs ? drv.ast.make<BinaryExprAST>(opChar, lhs.expr, rhs) : nullptr;
+    lhs.form = level == Logical ? Form::Condition : level == Relational ? Form::Relation : Form::Arith;
+  }
+  return lhs;
+}
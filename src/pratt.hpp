@@ -0,0 +1,73 @@
+#ifndef PRATT_HPP
+#define PRATT_HPP
+
+#include <optional>
+
+#include "parser.hpp"
+
+// Hand-written parser for the grammar of parser.yy: recursive descent for
+// definitions and statements, precedence climbing (Pratt) for expressions.
+// It builds the same AST as the Bison parser, straight into the driver's
+// arena, accepts the same programs and streams top-level definitions the
+// same way. Like the Bison parser, it stops at the first syntax error.
+class PrattParser {
+public:
+  PrattParser(driver &drv) : drv(drv) {};
+  int parse();  // 0 on success, as yy::parser::parse
+
+private:
+  // The grammar tells arithmetic expressions (exp) from relations (relexp) and
+  // conditions (condexp); each parsed expression carries which one it is.
+  // Only a relation can be the left operand of "and"/"or", only a relation or
+  // a condition can be tested, and only an arithmetic expression has a value.
+  enum class Form : unsigned char { Arith, Relation, Condition };
+  struct Operand {
+    ExprAST *expr = nullptr;  // Null after a syntax error
+    Form form = Form::Arith;
+  };
+
+  // Binding power of the infix operators, from the %left declarations
+  enum Level : unsigned char { None, Ternary, Logical, Relational, Additive, Multiplicative };
+
+  struct Token {
+    yy::parser::symbol_kind_type kind;
+    yy::location loc;
+    double number;  // For "number"
+    Ident ident;  // For "id"
+  };
+
+  driver &drv;
+  Token tok;
+  bool pending = false;  // tok is a lookahead not consumed yet
+  bool failed = false;
+
+  // Tokens are read lazily: a definition is streamed before the token after its ";"
+  const Token &peek();
+  Token take() { peek(); pending = false; return tok; };
+  bool accept(yy::parser::symbol_kind_type kind);
+  bool expect(yy::parser::symbol_kind_type kind, Token *out = nullptr);
+  void error(const char *expecting = nullptr);  // At the lookahead
+
+  bool parseType(std::optional<ValueType> &type);  // Optional ": type"; false after an error
+  RootAST *parseGlobal();
+  PrototypeAST *parseProto();
+  FunctionAST *parseDefinition();
+  BlockExprAST *parseBlock();
+  VarBindingAST *parseBinding();
+  ExprAST *parseStmt();
+  ExprAST *parseIf();
+  ExprAST *parseFor();
+  ExprAST *parseWhile();
+  AssignmentExprAST *parseAssignment();
+  ExprAST *parseExp();
+  ExprAST *parseCond();
+  ExprAST *requireArith(Operand o);
+  ExprAST *requireCond(Operand o);
+  Operand parseUnary();
+  Operand parseIdSuffix(const Token &id);
+  Operand parseBinary(Operand lhs, Level min);
+  ExprAST *parseOperand(Level min, bool afterRelation);
+  static Level levelOf(yy::parser::symbol_kind_type kind);
+};
+
+#endif // ! PRATT_HPP
@@ -0,0 +1,251 @@
+#include "driver.hpp"
+#include "utils.hpp"
+
+
+bool Resolver::resolve(RootAST *root) {
+  unsigned before = drv.errors;
+  unresolved = 0;
+
+  // Top-level declarations come first, so that bodies can refer to later ones
+  if (auto *seq = dyn_cast<SeqAST>(root))
+    for (auto top : seq->getElems())
+      declareTopLevel(top);
+  else
+    declareTopLevel(root);  // A single definition, when streaming
+
+  root->resolve(*this);
+
+  if (unresolved)
+    *drv.diag << drv.file << ": " << unresolved << " unresolved name" << (unresolved > 1 ? "s" : "") << std::endl;
+  return drv.errors == before;
+}
+
+void Resolver::declareTopLevel(RootAST *top) {
+  if (auto *proto = dyn_cast<PrototypeAST>(top))
+    proto->declare(*this, false);
+  else if (auto *fun = dyn_cast<FunctionAST>(top))
+    fun->getProto()->declare(*this, true);
+  else if (auto *global = dyn_cast<GlobalVarAST>(top))
+    global->declare(*this);
+}
+
+Binding Resolver::lookupVariable(Ident name, const SourceLoc &loc) {
+  Binding b = variables.lookup(name);
+  if (b.kind == Binding::Unresolved) {
+    error("Variabile " + name.str().str() + " non definita", loc);
+    unresolved++;
+  }
+  return b;
+}
+
+Binding Resolver::lookupFunction(Ident name, unsigned arity, const SourceLoc &loc) {
+  Binding b = functionNames.lookup(name);
+  if (b.kind == Binding::Unresolved && drv.stream) {
+    // The definition may still come: declared on trust, as a function of
+    // doubles, checked by finish() and declareFunction()
+    b = {Binding::Function, (unsigned)functions.size()};
+    functions.push_back({name, std::vector<ValueType>(arity, ValueType::Double), ValueType::Double, false, true, loc});
+    functionNames.bind(name, b);
+  }
+  else if (b.kind == Binding::Unresolved) {
+    error("Funzione " + name.str().str() + " non definita", loc);
+    unresolved++;
+  }
+  else if (functions[b.index].params.size() != arity)  // Params number check
+    error("Numero di argomenti non corretto nella chiamata a " + name.str().str(), loc);
+  return b;
+}
+
+unsigned Resolver::declareFunction(Ident name, const std::vector<Param> &params, ValueType ret, bool definition,
+                                   const SourceLoc &loc) {
+  std::vector<ValueType> types;
+  for (auto &param : params)
+    types.push_back(param.type);
+
+  Binding b = functionNames.lookup(name);
+  if (b.kind == Binding::Unresolved) {
+    b = {Binding::Function, (unsigned)functions.size()};
+    functions.push_back({name, types, ret, false, false, {}});
+    functionNames.bind(name, b);
+  }
+
+  FunctionInfo &info = functions[b.index];
+  if (info.params.size() != types.size())
+    error("Funzione " + name.str().str() + (info.implicit ? " già chiamata con " : " già dichiarata con ")
+          + std::to_string(info.params.size()) + " argomenti", loc);
+  else if (info.params != types || info.ret != ret)
+    error("Funzione " + name.str().str() + (info.implicit ? " già chiamata con argomenti e risultato double"
+                                                          : " già dichiarata con tipi diversi"), loc);
+  else if (definition && info.defined)
+    error("Funzione " + name.str().str() + " già definita", loc);
+  else if (definition)
+    info.defined = true;
+  info.implicit = false;
+  return b.index;
+}
+
+unsigned Resolver::declareGlobal(Ident name, unsigned size, ValueType type, const SourceLoc &loc) {
+  Binding b = variables.lookup(name);
+  if (b.kind == Binding::Unresolved) {
+    b = {Binding::Global, (unsigned)globals.size()};
+    globals.push_back({name, size, type});
+    variables.bind(name, b);
+  }
+  else if (globals[b.index].size != size)
+    error("Variabile globale " + name.str().str() + " già dichiarata con dimensione diversa", loc);
+  else if (globals[b.index].type != type)
+    error("Variabile globale " + name.str().str() + " già dichiarata con tipo diverso", loc);
+  return b.index;
+}
+
+bool Resolver::finish() {
+  unsigned missing = 0;
+  for (auto &info : functions)
+    if (info.implicit) {
+      error("Funzione " + info.name.str().str() + " non definita", info.firstUse);
+      info.implicit = false;  // Reported once
+      missing++;
+    }
+  if (missing)
+    *drv.diag << drv.file << ": " << missing << " unresolved name" << (missing > 1 ? "s" : "") << std::endl;
+  return missing == 0;
+}
+
+void Resolver::enterFunction(const std::vector<Param> &params) {
+  variables.pushScope();
+  frameSize = 0;
+  loops = 0;
+  for (auto &param : params)
+    variables.bind(param.name, {Binding::Argument, frameSize++});
+}
+
+unsigned Resolver::leaveFunction() {
+  variables.popScope();
+  return frameSize;
+}
+
+void Resolver::error(const std::string &msg, const SourceLoc &loc) {
+  logError(msg, drv, loc);
+}
+
+
+// Non-virtual dispatch, as for codegen. Leaves without names are skipped.
+void RootAST::resolve(Resolver &R) {
+  switch (Kind) {
+  case ASTKind::Seq:        return static_cast<SeqAST*>(this)->resolve(R);
+  case ASTKind::Variable:   return static_cast<VariableExprAST*>(this)->resolve(R);
+  case ASTKind::Slicing:    return static_cast<SlicingExprAST*>(this)->resolve(R);
+  case ASTKind::Binary:     return static_cast<BinaryExprAST*>(this)->resolve(R);
+  case ASTKind::Call:       return static_cast<CallExprAST*>(this)->resolve(R);
+  case ASTKind::If:         return static_cast<IfExprAST*>(this)->resolve(R);
+  case ASTKind::Block:      return static_cast<BlockExprAST*>(this)->resolve(R);
+  case ASTKind::VarBinding: return static_cast<VarBindingAST*>(this)->resolve(R);
+  case ASTKind::Function:   return static_cast<FunctionAST*>(this)->resolve(R);
+  case ASTKind::Assignment: return static_cast<AssignmentExprAST*>(this)->resolve(R);
+  case ASTKind::For:        return static_cast<ForExprAST*>(this)->resolve(R);
+  case ASTKind::While:      return static_cast<WhileExprAST*>(this)->resolve(R);
+  case ASTKind::Break:
+  case ASTKind::Continue:   return static_cast<JumpExprAST*>(this)->resolve(R);
+  case ASTKind::Return:     return static_cast<ReturnExprAST*>(this)->resolve(R);
+  case ASTKind::Number:
+  case ASTKind::Prototype:  // Declared with the other top-level definitions
+  case ASTKind::GlobalVar:
+    return;
+  }
+};
+
+void SeqAST::resolve(Resolver &R) {
+  for (auto elem : elems)
+    elem->resolve(R);
+}
+
+void VariableExprAST::resolve(Resolver &R) {
+  B = R.lookupVariable(Name, Loc);
+}
+
+void SlicingExprAST::resolve(Resolver &R) {
+  VariableExprAST::resolve(R);
+  IdxExpr->resolve(R);
+}
+
+void BinaryExprAST::resolve(Resolver &R) {
+  LHS->resolve(R);
+  if (RHS) RHS->resolve(R);
+}
+
+void CallExprAST::resolve(Resolver &R) {
+  B = R.lookupFunction(Callee, Args.size(), Loc);
+  for (auto arg : Args)
+    arg->resolve(R);
+}
+
+void IfExprAST::resolve(Resolver &R) {
+  Cond->resolve(R);
+  TrueExp->resolve(R);
+  if (FalseExp) FalseExp->resolve(R);
+}
+
+void BlockExprAST::resolve(Resolver &R) {
+  // Bindings shadow outer variables until the end of the block
+  R.pushScope();
+  for (auto &def : Def)
+    def->resolve(R);
+  Seq->resolve(R);
+  R.popScope();
+}
+
+void VarBindingAST::resolve(Resolver &R) {
+  // The initializer still sees the shadowed variable, if any
+  if (Val) Val->resolve(R);
+  for (auto init : InitializerList)
+    init->resolve(R);
+  Slot = R.bindLocal(Name);
+}
+
+void PrototypeAST::declare(Resolver &R, bool definition) {
+  Index = R.declareFunction(Name, Params, RetType, definition, Loc);
+}
+
+void FunctionAST::resolve(Resolver &R) {
+  R.enterFunction(Proto->getParams());
+  Body->resolve(R);
+  FrameSize = R.leaveFunction();
+}
+
+void GlobalVarAST::declare(Resolver &R) {
+  index = R.declareGlobal(name, size, type, loc);
+}
+
+void AssignmentExprAST::resolve(Resolver &R) {
+  b = R.lookupVariable(name, loc);
+  val->resolve(R);
+  if (idxExpr) idxExpr->resolve(R);
+}
+
+void ForExprAST::resolve(Resolver &R) {
+  // A variable bound by init is visible in the rest of the loop only
+  R.pushScope();
+  init->resolve(R);
+  cond->resolve(R);
+  R.enterLoop();
+  body->resolve(R);
+  R.leaveLoop();
+  assignment->resolve(R);
+  R.popScope();
+}
+
+void WhileExprAST::resolve(Resolver &R) {
+  cond->resolve(R);
+  R.enterLoop();
+  body->resolve(R);
+  R.leaveLoop();
+}
+
+void JumpExprAST::resolve(Resolver &R) {
+  if (not R.inLoop())
+    R.error(getKind() == ASTKind::Break ? "break fuori da un ciclo" : "continue fuori da un ciclo", loc);
+}
+
+void ReturnExprAST::resolve(Resolver &R) {
+  val->resolve(R);
+}
@@ -0,0 +1,95 @@
+#ifndef RESOLVER_HPP
+#define RESOLVER_HPP
+
+#include <string>
+#include <vector>
+
+#include "symbols.hpp"
+#include "types.hpp"
+
+class driver;
+class RootAST;
+
+// Compact source position, kept by the nodes diagnostics can point at
+struct SourceLoc {
+  unsigned line = 0, column = 0;
+
+  SourceLoc() = default;
+  template <typename Location>  // yy::location, declared by the parser
+  SourceLoc(const Location &l) : line(l.begin.line), column(l.begin.column) {};
+};
+
+// Where a name used in the AST lives, as found by name resolution.
+// Arguments and locals index the frame of the enclosing function (arguments
+// come first); globals and functions index the tables of the Resolver.
+struct Binding {
+  enum Kind : unsigned char { Unresolved, Argument, Local, Global, Function };
+  Kind kind = Unresolved;
+  unsigned index = 0;
+
+  bool isFrameSlot() const { return kind == Argument || kind == Local; };
+};
+
+struct FunctionInfo {
+  Ident name;
+  std::vector<ValueType> params;
+  ValueType ret;
+  bool defined;  // A definition, not only an extern, has been seen
+  bool implicit;  // Streaming mode: only called so far, see Resolver::finish
+  SourceLoc firstUse;  // Of an implicit declaration
+};
+
+struct GlobalInfo {
+  Ident name;
+  unsigned size;  // 0 for scalars
+  ValueType type;  // Of the variable or of its elements
+};
+
+// Semantic analysis run on each AST before codegen.
+// Every variable use, assignment and call site is bound to a slot, so that
+// codegen never looks a name up and only reads the AST. Top-level functions
+// and globals are declared before any body is visited: they can be used
+// before their definition. Tables persist across the inputs of a driver.
+// When the driver streams, top-level definitions are resolved one at a time:
+// calling a function not seen yet declares it implicitly, and the declaration
+// must show up before the end of the input.
+class Resolver {
+public:
+  std::vector<FunctionInfo> functions;  // Indexed by Binding::index
+  std::vector<GlobalInfo> globals;  // Indexed by Binding::index
+
+  Resolver(driver &drv) : drv(drv) {};
+  bool resolve(RootAST *root);  // False if errors were reported, all of them at once
+  bool finish();  // End of an input: false if functions it called were never declared
+
+  // Used by the resolve() and declare() methods of the AST
+  unsigned declareFunction(Ident name, const std::vector<Param> &params, ValueType ret, bool definition,
+                           const SourceLoc &loc);
+  unsigned declareGlobal(Ident name, unsigned size, ValueType type, const SourceLoc &loc);
+  Binding lookupVariable(Ident name, const SourceLoc &loc);
+  Binding lookupFunction(Ident name, unsigned arity, const SourceLoc &loc);
+  unsigned bindLocal(Ident name) {
+    variables.bind(name, {Binding::Local, frameSize});
+    return frameSize++;
+  };
+  void enterFunction(const std::vector<Param> &params);
+  unsigned leaveFunction();  // Returns the frame size
+  void enterLoop() { loops++; };
+  void leaveLoop() { loops--; };
+  bool inLoop() const { return loops; };
+  void pushScope() { variables.pushScope(); };
+  void popScope() { variables.popScope(); };
+  void error(const std::string &msg, const SourceLoc &loc);
+
+private:
+  driver &drv;
+  ScopedSymbolTable<Binding> variables;  // Globals in the outermost scope
+  ScopedSymbolTable<Binding> functionNames;  // Functions have their own namespace
+  unsigned frameSize = 0;  // Slots used so far by the current function
+  unsigned loops = 0;  // Enclosing the node being resolved, in the current function
+  unsigned unresolved = 0;  // Names not found in the current AST
+
+  void declareTopLevel(RootAST *top);
+};
+
+#endif // ! RESOLVER_HPP
@@ -2,24 +2,34 @@
 # include <cerrno>
 # include <climits>
 # include <cstdlib>
+# include <cstring>
+# include <algorithm>
 # include <string>
+# include <string_view>
 # include <cmath>
 # include "driver.hpp"
 # include "parser.hpp"
 %}
 
-%option noyywrap nounput batch debug noinput
+%option noyywrap nounput batch noinput
+%option reentrant extra-type="driver*"
 
 id      [a-zA-Z][a-zA-Z_0-9]*
 fpnum   [0-9]*\.?[0-9]+([eE][-+]?[0-9]+)?
 fixnum  (0|[1-9][0-9]*)\.?[0-9]*
 num     {fpnum}|{fixnum}
-blank   [ \t]
+blank   [ \t\r]
 comment #.*$
 
 %{
-  // Code executed at every regex match:
-  # define YY_USER_ACTION loc.columns(yyleng);
+  // Code executed at every regex match; flex's own debug output could only go
+  // to stderr, traces go where the driver says, as those of the hand lexer
+  # define YY_USER_ACTION loc.columns(yyleng); \
+    if (drv.trace_scanning) \
+      *drv.trace << "--scanned " << loc << ": \"" << std::string_view(yytext, yyleng) << "\"\n";
+  // Input comes from driver::source, already in memory, instead of a FILE*
+  # define YY_INPUT(buf, result, max_size) result = readInput(*yyextra, buf, max_size);
+  static size_t readInput(driver &drv, char *buf, size_t max_size);
 %}
 
 %%
@@ -71,11 +81,15 @@ comment #.*$
 "if"     { return yy::parser::make_IF(loc); }
 "else"   { return yy::parser::make_ELSE(loc); }
 "for"    { return yy::parser::make_FOR(loc); }
+"while"  { return yy::parser::make_WHILE(loc); }
+"break"  { return yy::parser::make_BREAK(loc); }
+"continue" { return yy::parser::make_CONTINUE(loc); }
+"return" { return yy::parser::make_RETURN(loc); }
 "not"    { return yy::parser::make_NOT(loc); }
 "and"    { return yy::parser::make_AND(loc); }
 "or"     { return yy::parser::make_OR(loc); }
 
-{id}     { return yy::parser::make_IDENTIFIER (yytext, loc); }
+{id}     { return yy::parser::make_IDENTIFIER (drv.names.intern(llvm::StringRef(yytext, yyleng)), loc); }
 
 .        { throw yy::parser::syntax_error
             (loc, "invalid character: " + std::string(yytext));
@@ -85,15 +99,19 @@ comment #.*$
 
 %%
 
+static size_t readInput(driver &drv, char *buf, size_t max_size) {
+  size_t n = std::min(max_size, drv.flexInput.size());
+  memcpy(buf, drv.flexInput.data(), n);
+  drv.flexInput = drv.flexInput.drop_front(n);
+  return n;
+}
+
 void driver::scan_begin () {
-  yy_flex_debug = trace_scanning;
-  if (file.empty() || file == "-") yyin = stdin;
-  else if (!(yyin = fopen (file.c_str(), "r"))) {
-    std::cerr << "cannot open " << file << ": " << strerror(errno) << '\n';
-    exit (EXIT_FAILURE);
-  }
+  yylex_init_extra(this, &scanner);
+  flexInput = source->getBuffer();
 }
 
 void driver::scan_end() {
-  fclose (yyin);
+  yylex_destroy(scanner);
+  scanner = nullptr;
 }
@@ -0,0 +1,116 @@
+#include "server.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+
+using namespace llvm;
+
+// Protocol: see client.cpp
+
+// A request is a command line: anything larger is not one. A client must send
+// it, and take the answer, within the timeout, or it loses its pool thread.
+static const size_t maxRequest = 1 << 20;
+static const time_t timeoutSeconds = 30;
+
+// False on error, timeout, or more than maxRequest bytes
+static bool readToEnd(int fd, std::string &data) {
+  char buf[4096];
+  for (;;) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return false;
+    if (n == 0) return true;
+    if (data.size() + n > maxRequest) return false;
+    data.append(buf, n);
+  }
+}
+
+// Whether the process at the other end of a connection runs as this one's user
+static bool sameUser(int fd) {
+  uid_t uid;
+#ifdef SO_PEERCRED
+  ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) return false;
+  uid = cred.uid;
+#else
+  gid_t gid;
+  if (getpeereid(fd, &uid, &gid) < 0) return false;
+#endif
+  return uid == geteuid();
+}
+
+static void serveConnection(int fd, const RequestHandler &handle) {
+  timeval timeout = {timeoutSeconds, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  std::string request;
+  std::vector<std::string> fields;
+  if (not readToEnd(fd, request)) {
+    writeFrame(fd, 'e', "kcomp server: request too large, or not sent in time\n") && writeFrame(fd, 's', "1");
+    close(fd);
+    return;
+  }
+  for (size_t pos = 0, end; (end = request.find('\0', pos)) != std::string::npos; pos = end + 1)
+    fields.push_back(request.substr(pos, end - pos));
+
+  if (not fields.empty()) {  // Otherwise the client went away: nothing to answer
+    std::string cwd = std::move(fields[0]);
+    fields.erase(fields.begin());
+    std::ostringstream out, err;
+    int res = handle(cwd, fields, out, err);
+    writeFrame(fd, 'o', out.str()) && writeFrame(fd, 'e', err.str()) && writeFrame(fd, 's', std::to_string(res));
+  }
+  close(fd);
+}
+
+int runServer(const std::string &path, unsigned jobs, const RequestHandler &handle) {
+  sockaddr_un addr;
+  if (not addressOf(path, addr)) return 1;
+
+  // A socket left behind by a previous server is replaced, anything else is not
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path.c_str());
+
+  // Requests write files as this user: the socket is created for the owner
+  // only, and peers running as anyone else are turned away anyway
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  mode_t umaskWas = umask(077);
+  bool bound = fd >= 0 && bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0;
+  umask(umaskWas);
+  if (not bound || chmod(path.c_str(), 0600) < 0 || listen(fd, SOMAXCONN) < 0) {
+    std::cerr << "cannot listen on " << path << ": " << strerror(errno) << std::endl;
+    if (fd >= 0) close(fd);
+    return 1;
+  }
+
+  ThreadPool pool(hardware_concurrency(jobs));
+  for (;;) {
+    int client = accept(fd, nullptr, nullptr);
+    if (client < 0 && (errno == EINTR || errno == ECONNABORTED)) continue;
+    if (client < 0) {
+      std::cerr << "accept: " << strerror(errno) << std::endl;
+      break;
+    }
+    if (not sameUser(client)) {
+      close(client);
+      continue;
+    }
+    pool.async([client, &handle] { serveConnection(client, handle); });
+  }
+  pool.wait();
+  close(fd);
+  return 1;
+}
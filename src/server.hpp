@@ -0,0 +1,34 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <sys/un.h>
+#include <vector>
+
+// Compiles one request: the arguments of a client, relative to its working
+// directory cwd. What a compilation run by the client itself would write on
+// stdout and stderr goes to out and err. Returns the client's exit code.
+// Requests are handled concurrently: the handler must be thread-safe.
+using RequestHandler = std::function<int(const std::string &cwd, const std::vector<std::string> &args,
+                                         std::ostream &out, std::ostream &err)>;
+
+// Listens on the Unix domain socket at path and hands each request to handle,
+// on a pool of jobs threads (0: one per hardware thread). Only this user may
+// connect; requests larger than 1 MiB, or not sent within 30 seconds, are
+// refused. Returns only on error.
+int runServer(const std::string &path, unsigned jobs, const RequestHandler &handle);
+
+// Forwards args and the working directory to the server listening at path,
+// copies back what it writes to stdout and stderr, and returns its exit code.
+// It does not need LLVM: kclient is a client alone, without LLVM to load.
+int runClient(const std::string &path, const std::vector<std::string> &args);
+
+// Both sides of the protocol, in client.cpp
+bool addressOf(const std::string &path, sockaddr_un &addr);  // False if path is too long
+bool writeAll(int fd, const char *data, size_t size);
+bool readAll(int fd, char *data, size_t size);  // False if the peer closed the connection first
+bool writeFrame(int fd, char tag, const std::string &payload);
+
+#endif // ! SERVER_HPP
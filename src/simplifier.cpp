@@ -0,0 +1,247 @@
+#include <cmath>
+
+#include "driver.hpp"
+
+void Simplifier::run(RootAST *root) {
+  root->simplify(*this);
+}
+
+RootAST *Simplifier::simplifyNode(RootAST *N) {
+  return N->simplify(*this);
+}
+
+ExprAST *Simplifier::number(double value) {
+  return ast.make<NumberExprAST>(value, true);
+}
+
+static bool isNumber(const ExprAST *E, double &value) {
+  auto *N = dyn_cast<NumberExprAST>(E);
+  if (N) value = N->getVal();
+  return N;
+}
+
+static bool isConstant(const ExprAST *E, double value) {
+  double v;
+  return isNumber(E, v) && v == value && std::signbit(v) == std::signbit(value);
+}
+
+static BinaryExprAST *asNegation(ExprAST *E) {
+  auto *B = dyn_cast<BinaryExprAST>(E);
+  return B && B->getOp() == '-' && not B->getRHS() ? B : nullptr;
+}
+
+ExprAST *Simplifier::negate(ExprAST *E) {
+  double value;
+  if (isNumber(E, value)) return number(-value);
+  if (auto *B = asNegation(E)) return B->getLHS();
+  return ast.make<UnaryExprAST>('-', E);
+}
+
+// Codegen compares unordered: a NaN operand makes "<", ">" and "==" true
+std::optional<bool> Simplifier::truth(ExprAST *cond) {
+  auto *B = dyn_cast<BinaryExprAST>(cond);
+  if (not B) return std::nullopt;
+  double l, r;
+  bool constant = isNumber(B->getLHS(), l) && B->getRHS() && isNumber(B->getRHS(), r);
+  bool unordered = constant && (std::isnan(l) || std::isnan(r));
+  std::optional<bool> lhs;
+  switch (B->getOp()) {
+  case '<':
+    if (constant) return unordered || l < r;
+    break;
+  case '>':
+    if (constant) return unordered || l > r;
+    break;
+  case '=':
+    if (constant) return unordered || l == r;
+    break;
+  case '!':
+    if ((lhs = truth(B->getLHS()))) return not *lhs;
+    break;
+  case '&':
+  case '|':
+    // The right operand is evaluated only when the left one does not settle
+    // the result; the left one is always evaluated: it goes only if constant
+    if (not (lhs = truth(B->getLHS()))) break;
+    if (*lhs == (B->getOp() == '|')) return *lhs;
+    return truth(B->getRHS());
+  }
+  return std::nullopt;
+}
+
+// Whether evaluating E can be skipped: it has no side effects
+static bool isLeaf(const ExprAST *E) {
+  return isa<NumberExprAST>(E) || E->getKind() == ASTKind::Variable;
+}
+
+// A power of two whose reciprocal is a normal number: dividing by it is exactly
+// multiplying by the reciprocal
+static bool hasExactReciprocal(double value) {
+  int exponent;
+  return std::frexp(value, &exponent) == 0.5 && std::isnormal(1 / value);
+}
+
+
+// Non-virtual dispatch, as for codegen. Returns the node that takes the place
+// of this one: itself, unless it could be simplified away.
+RootAST *RootAST::simplify(Simplifier &S) {
+  switch (Kind) {
+  case ASTKind::Seq:        static_cast<SeqAST*>(this)->simplify(S); break;
+  case ASTKind::Slicing:    static_cast<SlicingExprAST*>(this)->simplify(S); break;
+  case ASTKind::Binary:     return static_cast<BinaryExprAST*>(this)->simplify(S);
+  case ASTKind::Call:       static_cast<CallExprAST*>(this)->simplify(S); break;
+  case ASTKind::If:         return static_cast<IfExprAST*>(this)->simplify(S);
+  case ASTKind::Block:      static_cast<BlockExprAST*>(this)->simplify(S); break;
+  case ASTKind::VarBinding: static_cast<VarBindingAST*>(this)->simplify(S); break;
+  case ASTKind::Function:   static_cast<FunctionAST*>(this)->simplify(S); break;
+  case ASTKind::Assignment: static_cast<AssignmentExprAST*>(this)->simplify(S); break;
+  case ASTKind::For:        static_cast<ForExprAST*>(this)->simplify(S); break;
+  case ASTKind::While:      return static_cast<WhileExprAST*>(this)->simplify(S);
+  case ASTKind::Return:     static_cast<ReturnExprAST*>(this)->simplify(S); break;
+  case ASTKind::Break:
+  case ASTKind::Continue:
+  case ASTKind::Number:
+  case ASTKind::Variable:
+  case ASTKind::Prototype:
+  case ASTKind::GlobalVar:
+    break;
+  }
+  return this;
+};
+
+void SeqAST::simplify(Simplifier &S) {
+  for (auto &elem : elems)
+    S.simplify(elem);
+}
+
+void SlicingExprAST::simplify(Simplifier &S) {
+  S.simplify(IdxExpr);
+}
+
+ExprAST *BinaryExprAST::simplify(Simplifier &S) {
+  S.simplify(LHS);
+  if (RHS) S.simplify(RHS);
+  if (Op == '-' && RHS)
+    if (auto *neg = asNegation(RHS)) {  // x - (-y) is x + y
+      Op = '+';
+      RHS = neg->LHS;
+    }
+
+  double l = 0, r = 0;
+  bool lc = isNumber(LHS, l), rc = RHS && isNumber(RHS, r);
+  // Reassociation of constants: (x op c1) op c2 -> x op (c1 op c2)
+  auto reassociate = [&](char op, double (*fold)(double, double)) -> ExprAST* {
+    auto *inner = dyn_cast<BinaryExprAST>(LHS);
+    double c;
+    if (not S.fastMath || not rc || not inner || inner->Op != op || not isNumber(inner->RHS, c))
+      return this;
+    LHS = inner->LHS;
+    RHS = S.number(fold(c, r));
+    return this;
+  };
+
+  switch (Op) {
+  case '+':
+    if (lc && rc) return S.number(l + r);
+    if (isConstant(RHS, -0.0)) return LHS;  // x + -0 is x, even for x = -0
+    if (isConstant(LHS, -0.0)) return RHS;
+    if (S.fastMath && rc && r == 0) return LHS;
+    if (S.fastMath && lc && l == 0) return RHS;
+    return reassociate('+', [](double a, double b) { return a + b; });
+  case '-':
+    if (not RHS)
+      return lc || asNegation(LHS) ? S.negate(LHS) : this;
+    if (lc && rc) return S.number(l - r);
+    if (isConstant(RHS, 0.0)) return LHS;  // x - +0 is x, even for x = -0
+    // -0 - x is exactly -x; +0 - x is not, for x = +0
+    if (lc && l == 0 && (std::signbit(l) || S.fastMath)) return S.negate(RHS);
+    return this;
+  case '*':
+    if (lc && rc) return S.number(l * r);
+    if (rc && r == 1) return LHS;
+    if (lc && l == 1) return RHS;
+    if (rc && r == -1) return S.negate(LHS);
+    if (lc && l == -1) return S.negate(RHS);
+    if (S.fastMath && rc && r == 0 && isLeaf(LHS)) return RHS;  // Not for NaNs and infinities
+    if (S.fastMath && lc && l == 0 && isLeaf(RHS)) return LHS;
+    return reassociate('*', [](double a, double b) { return a * b; });
+  case '/':
+    if (lc && rc) return S.number(l / r);
+    if (rc && r == 1) return LHS;
+    if (rc && r == -1) return S.negate(LHS);
+    if (rc && r != 0 && std::isfinite(r) && (hasExactReciprocal(r) || S.fastMath)) {
+      Op = '*';
+      RHS = S.number(1 / r);
+      return this;
+    }
+    return this;
+  case '!':
+    if (auto *inner = dyn_cast<BinaryExprAST>(LHS))
+      if (inner->Op == '!') return inner->LHS;
+    return this;
+  case '&':
+  case '|':
+    // A constant left operand settles the result, or leaves the right one alone
+    if (auto lhs = S.truth(LHS)) return *lhs == (Op == '|') ? LHS : RHS;
+    return this;
+  default:  // Comparisons are folded by the if that tests them, see Simplifier::truth
+    return this;
+  }
+}
+
+void CallExprAST::simplify(Simplifier &S) {
+  for (auto &arg : Args)
+    S.simplify(arg);
+}
+
+ExprAST *IfExprAST::simplify(Simplifier &S) {
+  S.simplify(Cond);
+  S.simplify(TrueExp);
+  if (FalseExp) S.simplify(FalseExp);
+
+  auto taken = S.truth(Cond);
+  if (not taken) return this;
+  if (*taken) return TrueExp;
+  // Without an else, the value of the if is undefined: any constant will do
+  return FalseExp ? FalseExp : S.number(0);
+}
+
+void BlockExprAST::simplify(Simplifier &S) {
+  for (auto &def : Def)
+    def->simplify(S);
+  Seq->simplify(S);
+}
+
+void VarBindingAST::simplify(Simplifier &S) {
+  if (Val) S.simplify(Val);
+  for (auto &init : InitializerList)
+    S.simplify(init);
+}
+
+void FunctionAST::simplify(Simplifier &S) {
+  S.simplify(Body);
+}
+
+void AssignmentExprAST::simplify(Simplifier &S) {
+  S.simplify(val);
+  if (idxExpr) S.simplify(idxExpr);
+}
+
+void ForExprAST::simplify(Simplifier &S) {
+  init->simplify(S);
+  S.simplify(cond);
+  S.simplify(body);
+  assignment->simplify(S);
+}
+
+ExprAST *WhileExprAST::simplify(Simplifier &S) {
+  S.simplify(cond);
+  S.simplify(body);
+  // A loop never entered is dropped; its value is undefined, as the if's without else
+  auto taken = S.truth(cond);
+  return taken && not *taken ? S.number(0) : this;
+}
+
+void ReturnExprAST::simplify(Simplifier &S) {
+  S.simplify(val);
+}
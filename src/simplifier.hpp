@@ -0,0 +1,37 @@
+#ifndef SIMPLIFIER_HPP
+#define SIMPLIFIER_HPP
+
+#include <optional>
+
+#include "arena.hpp"
+
+class RootAST;
+class ExprAST;
+
+// AST simplification, run on each resolved AST before codegen, so that less IR
+// is generated and handed to LLVM. Constant subexpressions are folded and the
+// identities that are exact in IEEE arithmetic are applied (x*1, x/1, x-0,
+// -(-x), x*-1, division by a power of two); an if whose condition is constant
+// is replaced by the branch taken. With fastMath, also the rewrites that may
+// change results on signed zeros, NaNs and infinities or through rounding:
+// 0-x, x+0, x*0, reassociation of constants, division by any constant.
+// Operands that are dropped never have side effects.
+class Simplifier {
+public:
+  Simplifier(ASTArena &ast, bool fastMath) : fastMath(fastMath), ast(ast) {};
+  void run(RootAST *root);  // The root is simplified in place, never replaced
+
+  // Used by the simplify() methods of the AST
+  const bool fastMath;
+  template <typename Node>
+  void simplify(Node *&N) { N = static_cast<Node*>(simplifyNode(N)); };
+  ExprAST *number(double value);
+  ExprAST *negate(ExprAST *E);  // -E, folded when E is a number or a negation
+  std::optional<bool> truth(ExprAST *cond);  // Value of a constant condition
+
+private:
+  ASTArena &ast;
+  RootAST *simplifyNode(RootAST *N);
+};
+
+#endif // ! SIMPLIFIER_HPP
@@ -0,0 +1,90 @@
+#ifndef SYMBOLS_HPP
+#define SYMBOLS_HPP
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+// Interned identifier: a dense ID plus a pointer to the unique copy of its
+// spelling, so that comparing or indexing by name never touches characters.
+class Ident {
+private:
+  const llvm::StringMapEntry<unsigned> *entry;
+
+public:
+  Ident() : entry(nullptr) {};
+  explicit Ident(const llvm::StringMapEntry<unsigned> *entry) : entry(entry) {};
+
+  unsigned id() const { return entry->getValue(); };
+  llvm::StringRef str() const { return entry->getKey(); };
+  bool operator==(const Ident &other) const { return entry == other.entry; };
+  bool operator!=(const Ident &other) const { return entry != other.entry; };
+};
+
+// Owns the spelling of every identifier seen by a driver.
+// Equal spellings get the same Ident; IDs are dense, starting from 0.
+// An interner can instead forward to a shared one, as those of the workers
+// parsing pieces of one input do (see driver::parseParallel): each name is
+// cached locally, so the shared table is locked once per name and worker.
+class Interner {
+private:
+  llvm::StringMap<unsigned> ids;
+  Interner *shared = nullptr;
+  llvm::StringMap<Ident> forwarded;  // Names already interned by shared
+  std::mutex mutex;  // Of a shared interner
+
+  Ident internLocked(llvm::StringRef name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return intern(name);
+  };
+
+public:
+  void forwardTo(Interner &to) { shared = &to; };
+
+  Ident intern(llvm::StringRef name) {
+    if (shared) {
+      Ident &id = forwarded[name];
+      if (id == Ident()) id = shared->internLocked(name);
+      return id;
+    }
+    auto it = ids.try_emplace(name, ids.size()).first;
+    return Ident(&*it);
+  };
+
+  unsigned size() const { return ids.size(); };
+};
+
+// Symbol table indexed by identifier ID, with nested scopes.
+// Binding, lookup, and entering a scope are O(1); leaving a scope costs
+// O(bindings made in it): shadowed entries are restored from an undo log.
+template <typename T>
+class ScopedSymbolTable {
+private:
+  std::vector<T> slots;  // Innermost visible binding of each ID
+  std::vector<std::pair<unsigned, T>> shadowed;  // Undo log: ID and its previous binding
+  std::vector<size_t> scopes;  // Undo log size when each open scope was entered
+
+public:
+  T lookup(Ident name) const {
+    return name.id() < slots.size() ? slots[name.id()] : T();
+  };
+
+  void bind(Ident name, T value) {
+    if (name.id() >= slots.size()) slots.resize(name.id() + 1);
+    shadowed.emplace_back(name.id(), slots[name.id()]);
+    slots[name.id()] = value;
+  };
+
+  void pushScope() { scopes.push_back(shadowed.size()); };
+
+  void popScope() {
+    for (size_t mark = scopes.back(); shadowed.size() > mark; shadowed.pop_back())
+      slots[shadowed.back().first] = shadowed.back().second;
+    scopes.pop_back();
+  };
+};
+
+#endif // ! SYMBOLS_HPP
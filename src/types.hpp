@@ -0,0 +1,33 @@
+#ifndef TYPES_HPP
+#define TYPES_HPP
+
+#include <optional>
+
+#include "symbols.hpp"
+
+// Type of a value. Without annotations everything is a double; "int" is a
+// 64-bit integer and "f32" a single-precision float. Integral is what type
+// inference (see inference.hpp) finds for locals that are doubles in the
+// language but only ever hold integers: held as i64 too, they keep the
+// arithmetic of doubles. Conditions are Bool.
+enum class ValueType : unsigned char { Double, Float, Int, Integral, Bool };
+
+inline bool isInteger(ValueType t) {
+  return t == ValueType::Int || t == ValueType::Integral;
+}
+
+// Type named by an annotation, as in "var i : int"
+inline std::optional<ValueType> typeNamed(llvm::StringRef name) {
+  if (name == "double") return ValueType::Double;
+  if (name == "f32") return ValueType::Float;
+  if (name == "int") return ValueType::Int;
+  return std::nullopt;
+}
+
+// Parameter of a function prototype; those without annotation are doubles
+struct Param {
+  Ident name;
+  ValueType type;
+};
+
+#endif // ! TYPES_HPP
@@ -1,6 +1,8 @@
+#ifndef UTILS_HPP
+#define UTILS_HPP
+
 #include <iostream>
 #include <variant>
-#include <optional>
 
 #include "driver.hpp"
 
@@ -17,57 +19,103 @@
 #include "llvm/IR/GlobalValue.h"
 #include "llvm/IR/GlobalVariable.h"
 
-extern LLVMContext *context;
-extern Module *module;
-extern IRBuilder<> *builder;
-
-Value *logWarning(const std::string msg, const driver& drv) {
-  std::cout
+// Diagnostics point at loc when given, at the scanner's position otherwise
+inline Value *logWarning(const std::string msg, const driver& drv, const SourceLoc &loc = {}) {
+  *drv.diag
     << drv.file.c_str()
-    << ":" << std::to_string(drv.location.begin.line)
-    << ":" << std::to_string(drv.location.begin.column)
+    << ":" << std::to_string(loc.line ? loc.line : drv.location.begin.line)
+    << ":" << std::to_string(loc.line ? loc.column : drv.location.begin.column)
     << ": " << msg
     << std::endl;
 
   return nullptr;
 }
 
-// Semantic error
-Value *logError(const std::string msg, const driver& drv) {
-  std::cout << "Error: ";
-  logWarning(msg, drv);
-  exit(1);
+// Semantic error: it is counted in the driver and nullptr is propagated up,
+// so that a failing compilation never takes down the whole process
+inline Value *logError(const std::string msg, driver& drv, const SourceLoc &loc = {}) {
+  *drv.diag << "Error: ";
+  logWarning(msg, drv, loc);
+  drv.errors++;
+  return nullptr;
 }
 
-static AllocaInst *CreateEntryBlockAlloca(Function *fun, StringRef varName, Type *varType = Type::getDoubleTy(*context)) {
+static AllocaInst *CreateEntryBlockAlloca(Function *fun, StringRef varName, Type *varType = nullptr) {
   IRBuilder<> TmpB(&fun->getEntryBlock(), fun->getEntryBlock().begin());
+  if (not varType) varType = TmpB.getDoubleTy();
   return TmpB.CreateAlloca(varType, nullptr, varName);
 }
 
+inline Type *getLLVMType(LLVMContext &context, ValueType t) {
+  switch (t) {
+  case ValueType::Float:    return Type::getFloatTy(context);
+  case ValueType::Int:
+  case ValueType::Integral: return Type::getInt64Ty(context);
+  case ValueType::Bool:     return Type::getInt1Ty(context);
+  default:                  return Type::getDoubleTy(context);
+  }
+}
+
 // Utility data type that models a symbol retrieved either from the global
-// namespace or from the symbol table.
+// namespace or from the frame of the current function.
 using Symbol = std::variant<GlobalVariable*, AllocaInst*>;
-using MaybeSymbol = std::optional<Symbol>;
 
-MaybeSymbol tryGetSymbol(driver &drv, const std::string &name) {
-  // Notice that NamedValues is the locally-defined symbol table
-  AllocaInst *A = drv.NamedValues[name];
-  GlobalVariable *G = module->getNamedGlobal(name);
+// Declaration of a resolved function in the unit, created on first use
+inline Function *getFunction(driver &drv, unsigned index) {
+  Function *&F = drv.unit.functions[index];
+  if (not F) {
+    auto &context = drv.unit.context;
+    const FunctionInfo &info = drv.resolver.functions[index];
+    std::vector<Type*> params;
+    for (ValueType t : info.params)
+      params.push_back(getLLVMType(*context, t));
+    FunctionType *FT = FunctionType::get(getLLVMType(*context, info.ret), params, false);
+    F = Function::Create(FT, Function::ExternalLinkage, info.name.str(), *drv.unit.module);
+  }
+  return F;
+}
+
+// Definition of a resolved global in the unit, created on first use
+inline GlobalVariable *getGlobal(driver &drv, unsigned index) {
+  GlobalVariable *&G = drv.unit.globals[index];
+  if (not G) {
+    auto &context = drv.unit.context;
+    const GlobalInfo &info = drv.resolver.globals[index];
+    Type *t = getLLVMType(*context, info.type);
+    if (info.size) t = ArrayType::get(t, info.size);
 
-  if (A) return A;
-  if (G) return G;
+    G = new GlobalVariable(
+      *drv.unit.module,
+      t,
+      false,  // Not constant
+      GlobalValue::LinkageTypes::CommonLinkage,
+      Constant::getNullValue(t),
+      info.name.str()
+    );
+  }
+  return G;
+}
 
-  logWarning("Variabile " + name + " non definita", drv);
-  return std::nullopt;
+// No lookup: the resolver already knows where the name lives
+inline Symbol getSymbol(driver &drv, Binding b) {
+  if (b.kind == Binding::Global) return getGlobal(drv, b.index);
+  return drv.unit.frame[b.index];
 }
 
-Value* toInt(Value *v) {
-  Value *floatVal = builder->CreateFPTrunc(v, Type::getFloatTy(*context));
-  return builder->CreateFPToSI(floatVal, Type::getInt32Ty(*context));
+// Only between numbers: booleans are never converted. Floating-point values
+// are truncated to integers, as C does.
+inline Value *convert(IRBuilder<> &builder, Value *v, ValueType from, ValueType to) {
+  if (from == to || from == ValueType::Bool || (isInteger(from) && isInteger(to))) return v;
+  Type *type = getLLVMType(builder.getContext(), to);
+  if (isInteger(from)) return builder.CreateSIToFP(v, type);
+  if (isInteger(to)) return builder.CreateFPToSI(v, type);
+  return builder.CreateFPCast(v, type);  // Between f32 and double
 }
 
-Type *getSymbolType(const Symbol &s) {
+inline Type *getSymbolType(const Symbol &s) {
   return std::holds_alternative<AllocaInst*>(s) ?
     std::get<AllocaInst*>(s)->getAllocatedType() :
     std::get<GlobalVariable*>(s)->getValueType();
-}
\ No newline at end of file
+}
+
+#endif // ! UTILS_HPP